@@ -0,0 +1,141 @@
+// Sends Browse requests to a running server and reports the coroutine frames and heap allocations they took,
+// as counted by its /stats. Allocations are only counted when the server was built with EEMS_COUNT_ALLOCATIONS.
+//
+// Usage: browse_bench <host> <port> [object id] [requests]
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http/read.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/write.hpp>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace
+{
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+constexpr std::size_t default_requests = 10000;
+
+struct server_stats
+{
+    std::uint64_t requests;
+    std::uint64_t frames;
+    std::uint64_t heap_frames;
+    std::optional<std::uint64_t> allocations;
+};
+
+auto browse_body(std::string_view object_id) -> std::string
+{
+    return fmt::format(
+        R"(<?xml version="1.0" encoding="utf-8"?>)"
+        R"(<s:Envelope xmlns:s="http://schemas.xmlsoap.org/soap/envelope/" s:encodingStyle="http://schemas.xmlsoap.org/soap/encoding/">)"
+        R"(<s:Body><u:Browse xmlns:u="urn:schemas-upnp-org:service:ContentDirectory:1">)"
+        R"(<ObjectID>{}</ObjectID><BrowseFlag>BrowseDirectChildren</BrowseFlag><Filter>*</Filter>)"
+        R"(<StartingIndex>0</StartingIndex><RequestedCount>50</RequestedCount><SortCriteria></SortCriteria>)"
+        R"(</u:Browse></s:Body></s:Envelope>)",
+        object_id);
+}
+
+auto exchange(beast::tcp_stream& stream, beast::flat_buffer& buffer, http::request<http::string_body>& req)
+    -> http::response<http::string_body>
+{
+    http::write(stream, req);
+    auto res = http::response<http::string_body>{};
+    http::read(stream, buffer, res);
+    if (res.result() != http::status::ok)
+        throw std::runtime_error(fmt::format("{} {} failed: {}", req.method_string(), req.target(), res.result_int()));
+    return res;
+}
+
+auto find_number(std::string_view json, std::string_view key) -> std::optional<std::uint64_t>
+{
+    auto const name = fmt::format(R"("{}":)", key);
+    auto const at = json.find(name);
+    if (at == json.npos)
+        return {};
+    auto value = std::uint64_t{};
+    auto const begin = json.data() + at + name.size();
+    if (std::from_chars(begin, json.data() + json.size(), value).ec != std::errc{})
+        return {};
+    return value;
+}
+
+auto get_stats(beast::tcp_stream& stream, beast::flat_buffer& buffer, std::string const& host) -> server_stats
+{
+    auto req = http::request<http::string_body>{http::verb::get, "/stats", 11};
+    req.set(http::field::host, host);
+    auto const res = exchange(stream, buffer, req);
+    auto const& json = res.body();
+    return {
+        .requests = find_number(json, "requests").value_or(0),
+        .frames = find_number(json, "frames").value_or(0),
+        .heap_frames = find_number(json, "heap_frames").value_or(0),
+        .allocations = find_number(json, "allocations"),
+    };
+}
+}
+
+int main(int argc, char const* argv[])
+{
+    if (argc < 3)
+    {
+        fmt::print(stderr, "Usage: {} <host> <port> [object id] [requests]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string const host = argv[1];
+    auto const object_id = argc > 3 ? std::string_view{argv[3]} : std::string_view{"0"};
+    auto const requests = argc > 4 ? std::stoul(argv[4]) : default_requests;
+
+    try
+    {
+        net::io_context io_context;
+        auto stream = beast::tcp_stream{io_context};
+        stream.connect(net::ip::tcp::resolver{io_context}.resolve(host, argv[2]));
+        auto buffer = beast::flat_buffer{};
+
+        auto req = http::request<http::string_body>{http::verb::post, "/upnp/cds", 11};
+        req.set(http::field::host, host);
+        req.set(http::field::content_type, R"(text/xml; charset="utf-8")");
+        req.set("SOAPACTION", R"("urn:schemas-upnp-org:service:ContentDirectory:1#Browse")");
+        req.body() = browse_body(object_id);
+        req.prepare_payload();
+
+        // The first request warms up the caches of the server.
+        exchange(stream, buffer, req);
+
+        auto const before = get_stats(stream, buffer, host);
+        auto const start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < requests; ++i)
+            exchange(stream, buffer, req);
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+        auto const after = get_stats(stream, buffer, host);
+
+        // Both stats requests count themselves, so the difference includes the second one.
+        auto const served = static_cast<double>(after.requests - before.requests - 1);
+        fmt::print("{} requests in {} ms\n", requests,
+                   std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+        fmt::print("{:.2f} frames, {:.2f} from the heap per request\n", (after.frames - before.frames) / served,
+                   (after.heap_frames - before.heap_frames) / served);
+        if (before.allocations && after.allocations)
+            fmt::print("{:.1f} allocations per request\n", (*after.allocations - *before.allocations) / served);
+    }
+    catch (std::exception const& e)
+    {
+        fmt::print(stderr, "{}\n", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Builds scan_bench at two revisions and prints the allocations per scanned item of each, by default from before and
+# after the scanner reused its FlatBufferBuilders (aeb9c08).
+#
+# Usage: bench/compare_scan_allocations.sh [base] [head] [movies] [cmake options...]
+# Run it with the build environment set up (e.g. after sourcing Conan's conanbuild.sh), the cmake options are passed
+# to both configurations. The benchmark is taken from this checkout, so revisions which predate it can be measured.
+set -eu
+
+base=${1:-aeb9c08^}
+head=${2:-HEAD}
+movies=${3:-2000}
+if [ $# -gt 3 ]; then shift 3; else shift $#; fi
+
+repo=$(git rev-parse --show-toplevel)
+work=$(mktemp -d)
+cleanup()
+{
+    for name in base head; do
+        [ -d "$work/$name" ] && git -C "$repo" worktree remove --force "$work/$name"
+    done
+    rm -rf "$work"
+}
+trap cleanup EXIT
+
+for name in base head; do
+    eval rev=\$$name
+    tree="$work/$name"
+    git -C "$repo" worktree add --detach --quiet "$tree" "$rev"
+    cp -R "$repo/bench" "$tree/"
+    for file in allocation_stats.h allocation_stats.cpp; do
+        [ -e "$tree/src/$file" ] || cp "$repo/src/$file" "$tree/src/"
+    done
+    grep -q 'add_subdirectory(bench)' "$tree/CMakeLists.txt" || echo 'add_subdirectory(bench)' >>"$tree/CMakeLists.txt"
+
+    cmake -S "$tree" -B "$tree/build" -DCMAKE_BUILD_TYPE=Release -DEEMS_BUILD_BENCHMARKS=ON "$@" >"$work/$name.log"
+    cmake --build "$tree/build" --target scan_bench -j"$(nproc)" >>"$work/$name.log"
+    printf '%s (%s): ' "$rev" "$(git -C "$repo" rev-parse --short "$rev")"
+    "$tree/build/bin/scan_bench" "$movies" | tail -n 1
+done
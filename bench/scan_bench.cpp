@@ -0,0 +1,75 @@
+// Scans a generated library and reports the heap allocations of composing and storing its items.
+//
+// Usage: scan_bench [movies]
+
+#include "allocation_stats.h"
+#include "scanner/movie_scanner.h"
+#include "store/store_service.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <unistd.h>
+
+namespace
+{
+namespace fs = eems::fs;
+
+constexpr std::size_t default_movies = 2000;
+
+auto touch(fs::path const& path) -> void
+{
+    std::ofstream{path};
+}
+
+// A folder per movie, with the video, its poster and subtitles, like a typical library.
+auto create_library(fs::path const& root, std::size_t movies) -> void
+{
+    for (std::size_t i = 0; i < movies; ++i)
+    {
+        auto const year = 1950 + i % 70;
+        auto const folder = root / fmt::format("Movie Title {} ({})", i, year);
+        fs::create_directories(folder);
+        touch(folder / fmt::format("Movie.Title.{}.{}.1080p.BluRay.x264-GROUP.mkv", i, year));
+        touch(folder / "poster.jpg");
+        touch(folder / fmt::format("Movie.Title.{}.{}.1080p.BluRay.x264-GROUP.srt", i, year));
+    }
+}
+}
+
+int main(int argc, char const* argv[])
+{
+    auto const movies = argc > 1 ? std::stoul(argv[1]) : default_movies;
+    // Logging would be counted too.
+    spdlog::set_level(spdlog::level::warn);
+
+    auto const root = fs::temp_directory_path() / fmt::format("eems-scan-bench-{}", ::getpid());
+    auto const library = root / "library";
+    create_library(library, movies);
+
+    auto const allocations = [&]()
+    {
+        eems::store_service store{};
+        store.open_db({.db_path = root / "db"});
+        eems::movie_scanner scanner{store};
+        auto const journal = eems::ScanJournalKey{0};
+        scanner.start_scan(journal, library);
+
+        auto const before = eems::get_allocation_stats();
+        auto const start = std::chrono::steady_clock::now();
+        scanner.scan_all(journal, library, eems::movies_library_config{});
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+        auto const after = eems::get_allocation_stats();
+
+        fmt::print("{} items in {} ms\n", movies,
+                   std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+        return *after.allocations - *before.allocations;
+    }();
+    fs::remove_all(root);
+
+    fmt::print("{} allocations, {:.1f} per item\n", allocations, static_cast<double>(allocations) / movies);
+    return EXIT_SUCCESS;
+}
@@ -1,5 +1,5 @@
 from conan.tools.build import check_min_cppstd
-from conan.tools.cmake import CMake, cmake_layout
+from conan.tools.cmake import CMake, CMakeToolchain, cmake_layout
 
 from conan import ConanFile
 
@@ -7,14 +7,15 @@ from conan import ConanFile
 class EemsConan(ConanFile):
     name = "eems"
 
-    generators = "CMakeDeps", "CMakeToolchain"
+    generators = "CMakeDeps"
     settings = "os", "arch", "compiler", "build_type"
 
-    options = {"shared": [True, False], "fPIC": [True, False]}
+    options = {"shared": [True, False], "fPIC": [True, False], "io_uring": [True, False]}
 
     default_options = {
         "shared": False,
         "fPIC": True,
+        "io_uring": False,
         "date:use_system_tz_db": True,
         "boost:header_only": False,
         "boost:system_no_deprecated": True,
@@ -32,18 +33,28 @@ class EemsConan(ConanFile):
         "leveldb/1.23",
         "flatbuffers/2.0.8",
         "date/3.0.1",
+        "libjpeg-turbo/2.1.4",
     ]
 
     tool_requires = [
         "flatbuffers/2.0.8",
     ]
 
+    def requirements(self):
+        if self.options.io_uring:
+            self.requires("liburing/2.2")
+
     def validate(self):
         check_min_cppstd(self, "20")
 
     def layout(self):
         cmake_layout(self)
 
+    def generate(self):
+        tc = CMakeToolchain(self)
+        tc.variables["EEMS_USE_IO_URING"] = bool(self.options.io_uring)
+        tc.generate()
+
     def build(self):
         cmake = CMake(self)
 
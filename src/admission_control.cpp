@@ -0,0 +1,141 @@
+#include "admission_control.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace eems
+{
+
+admission_control::ticket::ticket(admission_control& control, net::ip::address const* client)
+    : control_{&control},
+      is_connection_{client != nullptr},
+      client_{client ? *client : net::ip::address{}}
+{
+}
+
+admission_control::ticket::ticket(ticket&& other) noexcept
+    : control_{std::exchange(other.control_, nullptr)},
+      is_connection_{other.is_connection_},
+      client_{other.client_}
+{
+}
+
+auto admission_control::ticket::operator=(ticket&& other) noexcept -> ticket&
+{
+    if (this != &other)
+    {
+        release();
+        control_ = std::exchange(other.control_, nullptr);
+        is_connection_ = other.is_connection_;
+        client_ = other.client_;
+    }
+    return *this;
+}
+
+admission_control::ticket::~ticket()
+{
+    release();
+}
+
+auto admission_control::ticket::release() noexcept -> void
+{
+    if (!control_)
+        return;
+
+    if (!is_connection_)
+    {
+        --control_->soap_requests_;
+    }
+    else
+    {
+        std::lock_guard lock{control_->mutex_};
+        if (control_->config_.max_connections && control_->connections_ >= control_->config_.max_connections)
+        {
+            // Acceptors see the freed connection once the lock is released. Sending doesn't block, the channel
+            // is full when its acceptor was already woken up.
+            for (auto* acceptor : control_->acceptors_)
+                acceptor->try_send(boost::system::error_code{});
+        }
+        --control_->connections_;
+        if (auto const it = control_->clients_.find(client_); it != control_->clients_.end() && !--it->second)
+        {
+            control_->clients_.erase(it);
+        }
+    }
+    control_ = nullptr;
+}
+
+admission_control::admission_control(server_config const& config)
+    : config_{config}
+{
+}
+
+auto admission_control::is_full() const -> bool
+{
+    std::lock_guard lock{mutex_};
+    return config_.max_connections && connections_ >= config_.max_connections;
+}
+
+auto admission_control::count_queued() -> void
+{
+    std::lock_guard lock{mutex_};
+    ++queued_connections_;
+}
+
+auto admission_control::add_acceptor(release_channel& channel) -> void
+{
+    std::lock_guard lock{mutex_};
+    acceptors_.push_back(&channel);
+}
+
+auto admission_control::remove_acceptor(release_channel& channel) -> void
+{
+    std::lock_guard lock{mutex_};
+    acceptors_.erase(std::remove(acceptors_.begin(), acceptors_.end(), &channel), acceptors_.end());
+}
+
+auto admission_control::admit_connection(net::ip::address const& client) -> ticket
+{
+    std::lock_guard lock{mutex_};
+    // Shards may accept at the same time, so the total can still be over the limit here.
+    auto const client_connections = clients_.find(client);
+    if ((config_.max_connections && connections_ >= config_.max_connections) ||
+        (config_.max_client_connections && client_connections != clients_.end() &&
+         client_connections->second >= config_.max_client_connections))
+    {
+        ++rejected_connections_;
+        return {};
+    }
+    ++connections_;
+    ++clients_[client];
+    return ticket{*this, &client};
+}
+
+auto admission_control::admit_soap_request() -> ticket
+{
+    // Requests don't take the lock, it's only needed for the clients of connections.
+    auto requests = soap_requests_.load(std::memory_order_relaxed);
+    do
+    {
+        if (config_.max_soap_requests && requests >= config_.max_soap_requests)
+        {
+            rejected_soap_requests_.fetch_add(1, std::memory_order_relaxed);
+            return {};
+        }
+    } while (!soap_requests_.compare_exchange_weak(requests, requests + 1, std::memory_order_relaxed));
+    return ticket{*this, nullptr};
+}
+
+auto admission_control::stats() const -> admission_stats
+{
+    std::lock_guard lock{mutex_};
+    return {
+        .connections = connections_,
+        .soap_requests = soap_requests_.load(std::memory_order_relaxed),
+        .rejected_connections = rejected_connections_,
+        .rejected_soap_requests = rejected_soap_requests_.load(std::memory_order_relaxed),
+        .queued_connections = queued_connections_,
+    };
+}
+
+}
@@ -0,0 +1,96 @@
+#ifndef EEMS_ADMISSION_CONTROL_H
+#define EEMS_ADMISSION_CONTROL_H
+
+#include "net.h"
+#include "server_config.h"
+
+#include <boost/asio/experimental/concurrent_channel.hpp>
+#include <boost/asio/ip/address.hpp>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace eems
+{
+
+// Limits the connections, in total and of each client, and the SOAP requests handled at the same time,
+// so a misbehaving client can't take the resources of the others. Shared by all shards, safe to use
+// from several threads.
+class admission_control
+{
+public:
+    struct admission_stats
+    {
+        std::size_t connections;
+        std::size_t soap_requests;
+        // Connections and requests answered with 503.
+        std::uint64_t rejected_connections;
+        std::uint64_t rejected_soap_requests;
+        // Times accepting waited for a connection to close.
+        std::uint64_t queued_connections;
+    };
+
+    // Held while an admitted connection or request is served, empty when it was rejected.
+    class ticket
+    {
+    public:
+        ticket() = default;
+        ticket(ticket&& other) noexcept;
+        auto operator=(ticket&& other) noexcept -> ticket&;
+        ~ticket();
+
+        explicit operator bool() const noexcept
+        {
+            return control_ != nullptr;
+        }
+
+    private:
+        friend class admission_control;
+
+        ticket(admission_control& control, net::ip::address const* client);
+
+        auto release() noexcept -> void;
+
+        admission_control* control_{nullptr};
+        // Of a connection, none for a request.
+        bool is_connection_{false};
+        net::ip::address client_;
+    };
+
+    // Signalled when a connection closes while all of them were taken. It holds a single signal, so one which
+    // arrives before its acceptor waits isn't lost.
+    using release_channel = net::experimental::concurrent_channel<void(boost::system::error_code)>;
+
+    explicit admission_control(server_config const& config);
+
+    // All connections are taken, accepting waits until one closes.
+    auto is_full() const -> bool;
+    auto count_queued() -> void;
+
+    // Acceptors (one per shard) registered to be woken up when a connection is free again.
+    auto add_acceptor(release_channel& channel) -> void;
+    auto remove_acceptor(release_channel& channel) -> void;
+
+    auto admit_connection(net::ip::address const& client) -> ticket;
+    auto admit_soap_request() -> ticket;
+
+    auto stats() const -> admission_stats;
+
+private:
+    server_config const& config_;
+    mutable std::mutex mutex_;
+    std::size_t connections_{0};
+    std::map<net::ip::address, std::size_t> clients_;
+    std::uint64_t rejected_connections_{0};
+    // SOAP requests are counted without the lock.
+    std::atomic<std::size_t> soap_requests_{0};
+    std::atomic<std::uint64_t> rejected_soap_requests_{0};
+    std::uint64_t queued_connections_{0};
+    std::vector<release_channel*> acceptors_;
+};
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+#include "allocation_stats.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace eems
+{
+
+namespace
+{
+std::atomic<std::uint64_t> requests{0};
+std::atomic<std::uint64_t> frames{0};
+std::atomic<std::uint64_t> heap_frames{0};
+#ifdef EEMS_COUNT_ALLOCATIONS
+std::atomic<std::uint64_t> allocations{0};
+
+auto counted_alloc(std::size_t size, std::size_t alignment = 0) -> void*
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (!size)
+        size = 1;
+    auto* const result = alignment ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+                                   : std::malloc(size);
+    if (!result)
+        throw std::bad_alloc{};
+    return result;
+}
+#endif
+}
+
+auto count_request() noexcept -> void
+{
+    requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+auto count_frame(bool from_heap) noexcept -> void
+{
+    frames.fetch_add(1, std::memory_order_relaxed);
+    if (from_heap)
+        heap_frames.fetch_add(1, std::memory_order_relaxed);
+}
+
+auto get_allocation_stats() noexcept -> allocation_stats
+{
+    allocation_stats result{.requests = requests.load(std::memory_order_relaxed),
+                            .frames = frames.load(std::memory_order_relaxed),
+                            .heap_frames = heap_frames.load(std::memory_order_relaxed),
+                            .allocations = std::nullopt};
+#ifdef EEMS_COUNT_ALLOCATIONS
+    result.allocations = allocations.load(std::memory_order_relaxed);
+#endif
+    return result;
+}
+
+}
+
+#ifdef EEMS_COUNT_ALLOCATIONS
+// Replaces the global allocation functions, the nothrow ones call these.
+auto operator new(std::size_t size) -> void*
+{
+    return eems::counted_alloc(size);
+}
+
+auto operator new[](std::size_t size) -> void*
+{
+    return eems::counted_alloc(size);
+}
+
+auto operator new(std::size_t size, std::align_val_t alignment) -> void*
+{
+    return eems::counted_alloc(size, static_cast<std::size_t>(alignment));
+}
+
+auto operator new[](std::size_t size, std::align_val_t alignment) -> void*
+{
+    return eems::counted_alloc(size, static_cast<std::size_t>(alignment));
+}
+
+auto operator delete(void* p) noexcept -> void
+{
+    std::free(p);
+}
+
+auto operator delete[](void* p) noexcept -> void
+{
+    std::free(p);
+}
+
+auto operator delete(void* p, std::size_t) noexcept -> void
+{
+    std::free(p);
+}
+
+auto operator delete[](void* p, std::size_t) noexcept -> void
+{
+    std::free(p);
+}
+
+auto operator delete(void* p, std::align_val_t) noexcept -> void
+{
+    std::free(p);
+}
+
+auto operator delete[](void* p, std::align_val_t) noexcept -> void
+{
+    std::free(p);
+}
+
+auto operator delete(void* p, std::size_t, std::align_val_t) noexcept -> void
+{
+    std::free(p);
+}
+
+auto operator delete[](void* p, std::size_t, std::align_val_t) noexcept -> void
+{
+    std::free(p);
+}
+#endif
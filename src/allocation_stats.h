@@ -0,0 +1,28 @@
+#ifndef EEMS_ALLOCATION_STATS_H
+#define EEMS_ALLOCATION_STATS_H
+
+#include <cstdint>
+#include <optional>
+
+namespace eems
+{
+
+struct allocation_stats
+{
+    std::uint64_t requests;
+    // Coroutine frames of the request path, and how many of them weren't recycled but came from the heap.
+    std::uint64_t frames;
+    std::uint64_t heap_frames;
+    // Heap allocations since the start, only counted when built with EEMS_COUNT_ALLOCATIONS.
+    std::optional<std::uint64_t> allocations;
+};
+
+auto count_request() noexcept -> void;
+
+auto count_frame(bool from_heap) noexcept -> void;
+
+auto get_allocation_stats() noexcept -> allocation_stats;
+
+}
+
+#endif
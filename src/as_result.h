@@ -1,6 +1,11 @@
 #ifndef EEMS_AS_RESULT_H
 #define EEMS_AS_RESULT_H
 
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/detail/handler_cont_helpers.hpp>
+#include <boost/asio/use_awaitable.hpp>
 #include <boost/outcome/boost_result.hpp>
 #include <boost/outcome/experimental/status_result.hpp>
 
@@ -13,6 +18,19 @@ template <typename T, typename EC>
 using result = ::boost::outcome_v2::boost_result<T, EC>;
 using ::boost::outcome_v2::success;
 
+// Handlers return errors as codes: an HTTP status or a UPnP error to answer, anything else ends the connection.
+template <typename T = void>
+using io_result = result<T, ::boost::system::error_code>;
+
+// Keeps only whether it succeeded, e.g. of a write whose size isn't needed.
+template <typename T>
+inline auto discard_value(io_result<T> const& r) -> io_result<>
+{
+    if (!r)
+        return r.error();
+    return success();
+}
+
 template <typename CompletionToken>
 class as_result_t
 {
@@ -0,0 +1,208 @@
+#include "bandwidth_scheduler.h"
+
+#include <algorithm>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <spdlog/spdlog.h>
+
+namespace eems
+{
+
+namespace
+{
+// How much a bucket can save up, writes are up to a couple of MiB.
+constexpr auto burst_duration = std::chrono::milliseconds(500);
+constexpr double min_capacity = 4 * 1024 * 1024;
+// Part of the total budget bulk transfers can't touch while a real-time one is active.
+constexpr double real_time_reserve = 0.5;
+constexpr auto bitrate_window = std::chrono::seconds(1);
+// Players buffer ahead, but a transfer this far ahead of playback is a download.
+constexpr auto max_playback_lead = std::chrono::seconds(120);
+// A real-time transfer with less buffered than this is short of data, as is one of unknown rate this long
+// after it started.
+constexpr auto min_playback_lead = std::chrono::seconds(10);
+// A transfer which hasn't sent anything for this long is held up by its client (e.g. paused), not by others.
+constexpr auto stalled_after = std::chrono::seconds(1);
+// How long a bulk write waits while a real-time transfer is short of data, about as long as a write takes.
+constexpr auto bulk_backoff = std::chrono::milliseconds(100);
+}
+
+bandwidth_scheduler::token_bucket::token_bucket(std::uint64_t rate)
+    : rate{static_cast<double>(rate)},
+      capacity{std::max(min_capacity, static_cast<double>(rate) * std::chrono::duration<double>(burst_duration).count())},
+      tokens{capacity},
+      updated{std::chrono::steady_clock::now()}
+{
+}
+
+auto bandwidth_scheduler::token_bucket::refill(std::chrono::steady_clock::time_point now) -> void
+{
+    tokens = std::min(capacity, tokens + rate * std::chrono::duration<double>(now - updated).count());
+    updated = now;
+}
+
+auto bandwidth_scheduler::token_bucket::delay(double level) const -> std::chrono::steady_clock::duration
+{
+    if (!rate || tokens >= level)
+        return {};
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((level - tokens) / rate));
+}
+
+bandwidth_scheduler::transfer::transfer(bandwidth_scheduler& scheduler, client_state& client, std::int64_t resource, transfer_priority priority,
+                                        std::uint64_t media_rate)
+    : scheduler_{scheduler},
+      client_{client},
+      resource_{resource},
+      priority_{priority},
+      media_rate_{media_rate},
+      started_{std::chrono::steady_clock::now()},
+      last_sent_{started_},
+      window_start_{started_}
+{
+}
+
+bandwidth_scheduler::transfer::~transfer()
+{
+    std::lock_guard lock{scheduler_.mutex_};
+    scheduler_.transfers_.erase(this);
+    if (priority_ == transfer_priority::real_time)
+    {
+        --scheduler_.real_time_transfers_;
+    }
+    if (!--client_.transfers)
+    {
+        auto const address = client_.address;
+        scheduler_.clients_.erase(address);
+    }
+}
+
+auto bandwidth_scheduler::transfer::consume(std::size_t bytes) -> net::awaitable<void>
+{
+    auto const delay = account(bytes);
+    if (delay > std::chrono::steady_clock::duration::zero())
+    {
+        net::steady_timer timer{co_await net::this_coro::executor, delay};
+        co_await timer.async_wait(net::use_awaitable);
+    }
+}
+
+auto bandwidth_scheduler::transfer::account(std::size_t bytes) -> std::chrono::steady_clock::duration
+{
+    auto const now = std::chrono::steady_clock::now();
+    auto priority = transfer_priority{};
+    {
+        std::lock_guard lock{mutex_};
+        bytes_sent_ += bytes;
+        last_sent_ = now;
+        window_bytes_ += bytes;
+        if (auto const elapsed = now - window_start_; elapsed >= bitrate_window)
+        {
+            bitrate_ = static_cast<std::uint64_t>(window_bytes_ * 8 / std::chrono::duration<double>(elapsed).count());
+            window_start_ = now;
+            window_bytes_ = 0;
+        }
+
+        if (priority_ == transfer_priority::real_time && media_rate_ &&
+            static_cast<double>(bytes_sent_) / media_rate_ > std::chrono::duration<double>(now - started_ + max_playback_lead).count())
+        {
+            spdlog::debug("Transfer of {} to {} runs ahead of playback, it's bulk", resource_, client_.address.to_string());
+            priority_ = transfer_priority::bulk;
+            --scheduler_.real_time_transfers_;
+        }
+        if (is_waiting(now))
+        {
+            scheduler_.real_time_waited_.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+        priority = priority_;
+    }
+
+    // Rates don't change, only the buckets need the lock.
+    auto& total = scheduler_.total_;
+    auto& own = client_.bucket;
+    auto delay = std::chrono::steady_clock::duration{};
+    if (total.rate || own.rate)
+    {
+        std::lock_guard lock{scheduler_.mutex_};
+        total.refill(now);
+        own.refill(now);
+        total.tokens -= bytes;
+        own.tokens -= bytes;
+
+        auto const reserve = priority == transfer_priority::bulk && scheduler_.real_time_transfers_
+                                 ? total.capacity * real_time_reserve
+                                 : 0.0;
+        delay = std::max(total.delay(reserve), own.delay(0));
+    }
+    // Without a total budget there's nothing to reserve, so bulk transfers step back instead.
+    if (!total.rate && priority == transfer_priority::bulk && scheduler_.is_real_time_waiting(now))
+    {
+        delay = std::max<std::chrono::steady_clock::duration>(delay, bulk_backoff);
+    }
+    return delay;
+}
+
+auto bandwidth_scheduler::transfer::is_waiting(std::chrono::steady_clock::time_point now) const -> bool
+{
+    if (priority_ != transfer_priority::real_time || now - last_sent_ > stalled_after)
+        return false;
+    if (!media_rate_)
+        return now - started_ < min_playback_lead;
+    return static_cast<double>(bytes_sent_) / media_rate_ < std::chrono::duration<double>(now - started_ + min_playback_lead).count();
+}
+
+bandwidth_scheduler::bandwidth_scheduler(server_config const& config)
+    : config_{config},
+      total_{config.total_rate_limit}
+{
+}
+
+auto bandwidth_scheduler::start(net::ip::address const& client, std::int64_t resource, transfer_priority priority,
+                                std::uint64_t media_rate) -> transfer_ptr
+{
+    std::lock_guard lock{mutex_};
+    // Transfers of the same client share its budget.
+    auto [it, inserted] = clients_.try_emplace(client, client_state{client, token_bucket{config_.client_rate_limit}});
+    ++it->second.transfers;
+    if (priority == transfer_priority::real_time)
+    {
+        ++real_time_transfers_;
+        // Nothing is buffered yet.
+        real_time_waited_.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+    transfer_ptr result{new transfer{*this, it->second, resource, priority, media_rate}};
+    transfers_.insert(result.get());
+    return result;
+}
+
+// A waiting transfer keeps writing, so it has written recently.
+auto bandwidth_scheduler::is_real_time_waiting(std::chrono::steady_clock::time_point now) const -> bool
+{
+    auto const waited = std::chrono::steady_clock::time_point{
+        std::chrono::steady_clock::duration{real_time_waited_.load(std::memory_order_relaxed)}};
+    return real_time_transfers_ && now - waited <= stalled_after;
+}
+
+auto bandwidth_scheduler::stats() const -> std::vector<transfer_stats>
+{
+    auto const now = std::chrono::steady_clock::now();
+    std::lock_guard lock{mutex_};
+    std::vector<transfer_stats> result;
+    result.reserve(transfers_.size());
+    for (auto const* transfer : transfers_)
+    {
+        std::lock_guard transfer_lock{transfer->mutex_};
+        result.push_back({
+            .client = transfer->client_.address.to_string(),
+            .resource = transfer->resource_,
+            .priority = transfer->priority_,
+            .bytes_sent = transfer->bytes_sent_,
+            // A transfer which just started or stalled has no complete window yet.
+            .bitrate = now - transfer->window_start_ < 2 * bitrate_window ? transfer->bitrate_ : 0,
+            .duration = std::chrono::duration_cast<std::chrono::seconds>(now - transfer->started_),
+        });
+    }
+    return result;
+}
+
+}
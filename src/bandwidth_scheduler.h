@@ -0,0 +1,139 @@
+#ifndef EEMS_BANDWIDTH_SCHEDULER_H
+#define EEMS_BANDWIDTH_SCHEDULER_H
+
+#include "net.h"
+#include "server_config.h"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/ip/address.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace eems
+{
+
+enum class transfer_priority
+{
+    // Played while it's being received, e.g. a renderer streaming a movie.
+    real_time,
+    // Downloads, which can take whatever bandwidth real-time transfers leave.
+    bulk,
+};
+
+// Shares the upload bandwidth between transfers with token buckets: one per client and one for all of them.
+// Bulk transfers leave a part of the total budget to real-time ones, and without a total budget they step back
+// while a real-time transfer is short of data. A transfer which runs far ahead of playback is a download, so it
+// becomes bulk. Transfers pay for what they've sent, so a write is never split, it's the next one which is delayed.
+// Safe to use from several threads. A write only takes the scheduler's lock when there's a limit to share, the
+// counters of a transfer are its own.
+class bandwidth_scheduler
+{
+    struct client_state;
+
+public:
+    struct transfer_stats
+    {
+        std::string client;
+        std::int64_t resource;
+        transfer_priority priority;
+        std::uint64_t bytes_sent;
+        // Bits per second, over the last second or so.
+        std::uint64_t bitrate;
+        std::chrono::seconds duration;
+    };
+
+    class transfer
+    {
+    public:
+        transfer(transfer const&) = delete;
+        auto operator=(transfer const&) -> transfer& = delete;
+        ~transfer();
+
+        // Accounts for sent bytes and waits when the transfer is over its budget.
+        auto consume(std::size_t bytes) -> net::awaitable<void>;
+
+    private:
+        friend class bandwidth_scheduler;
+
+        transfer(bandwidth_scheduler& scheduler, client_state& client, std::int64_t resource, transfer_priority priority,
+                 std::uint64_t media_rate);
+
+        // Updates the counters and the buckets, returns how long to wait.
+        auto account(std::size_t bytes) -> std::chrono::steady_clock::duration;
+
+        // Playback is about to run out of data, while the client keeps reading. Called with the mutex locked.
+        auto is_waiting(std::chrono::steady_clock::time_point now) const -> bool;
+
+        bandwidth_scheduler& scheduler_;
+        // Guards the priority and the counters, which stats() reads.
+        mutable std::mutex mutex_;
+        client_state& client_;
+        std::int64_t resource_;
+        transfer_priority priority_;
+        // Bytes per second the media plays at, 0 when unknown.
+        std::uint64_t media_rate_;
+        std::chrono::steady_clock::time_point started_;
+        std::chrono::steady_clock::time_point last_sent_;
+        std::uint64_t bytes_sent_{0};
+        std::chrono::steady_clock::time_point window_start_;
+        std::uint64_t window_bytes_{0};
+        std::uint64_t bitrate_{0};
+    };
+    using transfer_ptr = std::unique_ptr<transfer>;
+
+    explicit bandwidth_scheduler(server_config const& config);
+
+    // The media rate (bytes per second of playback, 0 when unknown) tells a download from playback.
+    auto start(net::ip::address const& client, std::int64_t resource, transfer_priority priority,
+               std::uint64_t media_rate) -> transfer_ptr;
+
+    // Currently active transfers.
+    auto stats() const -> std::vector<transfer_stats>;
+
+private:
+    // Bytes per second, unlimited when the rate is 0. Tokens go negative when a write was larger than the budget.
+    struct token_bucket
+    {
+        explicit token_bucket(std::uint64_t rate);
+
+        auto refill(std::chrono::steady_clock::time_point now) -> void;
+        // How long until there are at least that many tokens.
+        auto delay(double level) const -> std::chrono::steady_clock::duration;
+
+        double rate;
+        double capacity;
+        double tokens;
+        std::chrono::steady_clock::time_point updated;
+    };
+
+    struct client_state
+    {
+        net::ip::address address;
+        token_bucket bucket;
+        std::size_t transfers{0};
+    };
+
+    auto is_real_time_waiting(std::chrono::steady_clock::time_point now) const -> bool;
+
+private:
+    server_config const& config_;
+    // Guards the buckets, the clients and the set of transfers.
+    mutable std::mutex mutex_;
+    token_bucket total_;
+    std::map<net::ip::address, client_state> clients_;
+    std::unordered_set<transfer const*> transfers_;
+    std::atomic<std::size_t> real_time_transfers_{0};
+    // When a real-time transfer last wrote while short of data, as steady_clock ticks.
+    std::atomic<std::chrono::steady_clock::rep> real_time_waited_{0};
+};
+
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include "byte_ranges.h"
+
+#include "spirit.h"
+
+#include <boost/fusion/adapted/std_tuple.hpp>
+#include <boost/fusion/include/std_tuple.hpp>
+#include <fmt/format.h>
+#include <random>
+
+namespace eems
+{
+
+namespace
+{
+// More ranges than this are more likely an attack than a player probing the file.
+constexpr std::size_t max_ranges{32};
+
+auto make_boundary() -> std::string
+{
+    thread_local std::mt19937_64 generator{std::random_device{}()};
+    return fmt::format("eems-{:016x}{:016x}", generator(), generator());
+}
+}
+
+auto parse_byte_ranges(std::string_view header, std::uintmax_t file_size)
+    -> std::optional<std::vector<byte_range>>
+{
+    std::vector<byte_range> result;
+    auto const whole_file = []()
+    { return std::vector<byte_range>{}; };
+
+    if (header.empty())
+    {
+        return whole_file();
+    }
+
+    using range_spec = std::tuple<std::optional<std::uintmax_t>, std::optional<std::uintmax_t>>;
+    std::vector<range_spec> specs;
+    constexpr x3::uint_parser<std::uintmax_t> uint_max;
+    auto const ows = *(x3::lit(' ') | '\t');
+    // The rule keeps each spec a tuple instead of flattening it into the list.
+    auto const spec = x3::rule<struct range_spec_tag, range_spec>{"range-spec"} = -uint_max >> '-' >> -uint_max;
+    // Empty list elements are allowed: "bytes=0-1, ,2-3".
+    auto const list = *(x3::lit(',') >> ows) >> (spec % +(ows >> ',' >> ows)) >> *(ows >> ',');
+    if (!parse(header, x3::no_case[x3::lit("bytes")] >> ows >> '=' >> ows >> list >> ows, specs) || specs.size() > max_ranges)
+    {
+        return whole_file();
+    }
+
+    for (auto const& [first, last] : specs)
+    {
+        if (first)
+        {
+            if (last && *last < *first)
+            {
+                // Syntactically invalid, so the whole header is ignored.
+                return whole_file();
+            }
+            if (*first >= file_size)
+            {
+                continue;
+            }
+            // The last position may be the largest number there is, so it isn't incremented before it's clamped.
+            auto const end = last && *last < file_size ? *last + 1 : file_size;
+            result.push_back({*first, end - *first});
+        }
+        else if (last)
+        {
+            // Suffix: the last N bytes.
+            if (*last == 0 || file_size == 0)
+            {
+                continue;
+            }
+            auto const size = std::min(*last, file_size);
+            result.push_back({file_size - size, size});
+        }
+        else
+        {
+            return whole_file();
+        }
+    }
+
+    if (result.empty())
+    {
+        return std::nullopt;
+    }
+    return result;
+}
+
+auto make_multipart_ranges(std::span<byte_range const> ranges, std::string_view content_type, std::uintmax_t file_size)
+    -> multipart_ranges
+{
+    multipart_ranges result{};
+    auto const boundary = make_boundary();
+    result.content_type = fmt::format("multipart/byteranges; boundary={}", boundary);
+
+    for (auto const& range : ranges)
+    {
+        // The first delimiter doesn't need the preceding line break.
+        auto const& header = result.part_headers.emplace_back(
+            fmt::format("{}--{}\r\nContent-Type: {}\r\nContent-Range: bytes {}-{}/{}\r\n\r\n",
+                        result.part_headers.empty() ? "" : "\r\n",
+                        boundary, content_type, range.offset, range.offset + range.size - 1, file_size));
+        result.content_length += header.size() + range.size;
+    }
+    result.closing = fmt::format("\r\n--{}--\r\n", boundary);
+    result.content_length += result.closing.size();
+    return result;
+}
+
+}
@@ -0,0 +1,41 @@
+#ifndef EEMS_BYTE_RANGES_H
+#define EEMS_BYTE_RANGES_H
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace eems
+{
+
+struct byte_range
+{
+    std::uint64_t offset;
+    std::uintmax_t size;
+};
+
+// Satisfiable ranges of a Range header (RFC 7233) in the requested order.
+// Empty when the whole file should be sent: the header is missing, invalid or uses
+// another unit. Returns nullopt when none of the ranges can be satisfied.
+auto parse_byte_ranges(std::string_view header, std::uintmax_t file_size)
+    -> std::optional<std::vector<byte_range>>;
+
+// Framing of a multipart/byteranges body: each part's header goes before its data,
+// the closing delimiter after the last part.
+struct multipart_ranges
+{
+    std::string content_type;
+    std::vector<std::string> part_headers;
+    std::string closing;
+    std::uintmax_t content_length{0};
+};
+
+auto make_multipart_ranges(std::span<byte_range const> ranges, std::string_view content_type, std::uintmax_t file_size)
+    -> multipart_ranges;
+
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef EEMS_CACHE_CONFIG_H
+#define EEMS_CACHE_CONFIG_H
+
+#include "fs.h"
+
+#include <cstdint>
+
+namespace eems
+{
+
+struct cache_config
+{
+    // Directory on a fast drive, caching is disabled when empty.
+    fs::path path;
+    // Beginning and end (where MP4 keeps its index) of each video to keep in the cache.
+    std::uintmax_t head_size{16 * 1024 * 1024};
+    std::uintmax_t tail_size{2 * 1024 * 1024};
+    // Total size of the cached videos, the least recently played ones are removed beyond it. 0 for unlimited.
+    std::uintmax_t max_size{std::uintmax_t{32} * 1024 * 1024 * 1024};
+
+    // Downscaled artwork.
+    auto artwork_path() const -> fs::path
+    {
+        return path.empty() ? fs::path{} : path / "artwork";
+    }
+};
+
+}
+
+#endif
@@ -7,6 +7,8 @@
 #include <boost/uuid/name_generator.hpp>
 #include <boost/uuid/string_generator.hpp>
 #include <fmt/core.h>
+#include <limits>
+#include <stdexcept>
 #include <toml.hpp>
 
 namespace eems
@@ -14,6 +16,9 @@ namespace eems
 namespace po = boost::program_options;
 using namespace std::string_literals;
 
+// More threads than this is a typo rather than a machine, and each of them reserves a stack.
+constexpr std::uintmax_t max_threads = 1024;
+
 struct string_hash : std::hash<std::string_view>
 {
     using is_transparent = std::true_type;
@@ -36,6 +41,24 @@ inline auto try_get(toml_table const& table, std::string const& value, F func)
     }
 }
 
+// Reads a non-negative integer option given in units (e.g. 1024 * 1024 for "_mb" options) and passes it on
+// in bytes (or whatever the unit is) as T. Values which don't fit are rejected rather than wrapped around.
+template <typename T, typename F>
+inline auto try_get_scaled(toml_table const& table, std::string const& value, std::uintmax_t unit, F func,
+                           std::uintmax_t min = 0, std::uintmax_t max = std::numeric_limits<T>::max())
+{
+    if (auto it = table.find(value); it != table.end())
+    {
+        auto const val = toml::get<toml::integer>(it->second);
+        if (val < 0 || static_cast<std::uintmax_t>(val) < min || static_cast<std::uintmax_t>(val) > max / unit)
+        {
+            throw std::runtime_error(fmt::format("{} must be between {} and {} at line {}", value, min, max / unit,
+                                                 it->second.location().line()));
+        }
+        func(static_cast<T>(static_cast<std::uintmax_t>(val) * unit));
+    }
+}
+
 auto load_movies_config(toml_table const& data)
     -> movies_library_config
 {
@@ -46,6 +69,22 @@ auto load_movies_config(toml_table const& data)
     return result;
 }
 
+auto load_page_cache_config(toml_table const& data)
+    -> page_cache_config
+{
+    page_cache_config result{};
+    try_get_scaled<std::uintmax_t>(data, "read_ahead_mb"s, 1024 * 1024, [&](auto val) {
+        result.read_ahead = val;
+    });
+    try_get<bool>(data, "drop_behind"s, [&](auto& val) {
+        result.drop_behind = val;
+    });
+    try_get_scaled<std::uintmax_t>(data, "direct_io_min_size_mb"s, 1024 * 1024, [&](auto val) {
+        result.direct_io_min_size = val;
+    });
+    return result;
+}
+
 auto load_data_config(toml_array const& data, data_config& config)
     -> void
 {
@@ -56,7 +95,7 @@ auto load_data_config(toml_array const& data, data_config& config)
 
         if (type == "movies")
         {
-            config.content_directories.push_back({path, load_movies_config(table.as_table())});
+            config.content_directories.push_back({path, load_movies_config(table.as_table()), load_page_cache_config(table.as_table())});
         }
         else
         {
@@ -71,6 +110,10 @@ auto load_db_config(toml_table const& data, store_config& config)
     try_get<std::string>(data, "path"s, [&](auto& val) {
         config.db_path = val;
     });
+
+    try_get_scaled<std::size_t>(data, "read_threads"s, 1, [&](auto val) {
+        config.read_threads = val;
+    }, 1, max_threads);
 }
 
 auto load_server_config(toml_table const& data, server_config& config)
@@ -80,8 +123,7 @@ auto load_server_config(toml_table const& data, server_config& config)
         config.uuid = boost::uuids::string_generator{}(val);
     });
 
-    try_get<toml::integer>(data, "port"s, [&](auto val) {
-        // TODO: check for overflow.
+    try_get_scaled<unsigned short>(data, "port"s, 1, [&](auto val) {
         config.listen_port = val;
     });
 
@@ -92,6 +134,73 @@ auto load_server_config(toml_table const& data, server_config& config)
     try_get<std::string>(data, "name"s, [&](auto& val) {
         config.name = val;
     });
+
+    try_get<bool>(data, "zero_copy"s, [&](auto& val) {
+        config.zero_copy = val;
+    });
+
+    try_get<bool>(data, "io_uring"s, [&](auto& val) {
+        config.io_uring = val;
+    });
+
+    try_get_scaled<std::uint64_t>(data, "client_rate_limit_mbps"s, 1000 * 1000 / 8, [&](auto val) {
+        config.client_rate_limit = val;
+    });
+
+    try_get_scaled<std::uint64_t>(data, "total_rate_limit_mbps"s, 1000 * 1000 / 8, [&](auto val) {
+        config.total_rate_limit = val;
+    });
+
+    // 0 picks one per CPU core.
+    try_get_scaled<std::size_t>(data, "threads"s, 1, [&](auto val) {
+        config.threads = val;
+    }, 0, max_threads);
+
+    try_get_scaled<std::size_t>(data, "io_threads"s, 1, [&](auto val) {
+        config.io_threads = val;
+    }, 1, max_threads);
+
+    try_get<bool>(data, "sharded"s, [&](auto& val) {
+        config.sharded = val;
+    });
+
+    try_get_scaled<std::chrono::seconds::rep>(data, "header_timeout_s"s, 1, [&](auto val) {
+        config.header_timeout = std::chrono::seconds(val);
+    });
+
+    try_get_scaled<std::chrono::seconds::rep>(data, "keep_alive_timeout_s"s, 1, [&](auto val) {
+        config.keep_alive_timeout = std::chrono::seconds(val);
+    });
+
+    try_get_scaled<std::chrono::seconds::rep>(data, "write_timeout_s"s, 1, [&](auto val) {
+        config.write_timeout = std::chrono::seconds(val);
+    });
+
+    try_get_scaled<std::size_t>(data, "max_connections"s, 1, [&](auto val) {
+        config.max_connections = val;
+    });
+
+    try_get_scaled<std::size_t>(data, "max_client_connections"s, 1, [&](auto val) {
+        config.max_client_connections = val;
+    });
+
+    try_get_scaled<std::size_t>(data, "max_soap_requests"s, 1, [&](auto val) {
+        config.max_soap_requests = val;
+    });
+
+    try_get_scaled<std::chrono::seconds::rep>(data, "retry_after_s"s, 1, [&](auto val) {
+        config.retry_after = std::chrono::seconds(val);
+    });
+
+    // Passed to setsockopt() as an int.
+    try_get_scaled<std::size_t>(data, "stream_send_buffer_kb"s, 1024, [&](auto val) {
+        config.stream_send_buffer = val;
+    }, 0, std::numeric_limits<int>::max());
+
+    // Passed to setsockopt() as an int.
+    try_get_scaled<std::size_t>(data, "stream_notsent_lowat_kb"s, 1024, [&](auto val) {
+        config.stream_notsent_lowat = val;
+    }, 0, std::numeric_limits<int>::max());
 }
 
 auto load_logging_config(toml_table const& data, logging_config& config)
@@ -105,6 +214,23 @@ auto load_logging_config(toml_table const& data, logging_config& config)
     });
 }
 
+auto load_cache_config(toml_table const& data, cache_config& config)
+    -> void
+{
+    try_get<std::string>(data, "path"s, [&](auto& val) {
+        config.path = val;
+    });
+    try_get_scaled<std::uintmax_t>(data, "head_size_mb"s, 1024 * 1024, [&](auto val) {
+        config.head_size = val;
+    });
+    try_get_scaled<std::uintmax_t>(data, "tail_size_mb"s, 1024 * 1024, [&](auto val) {
+        config.tail_size = val;
+    });
+    try_get_scaled<std::uintmax_t>(data, "max_size_mb"s, 1024 * 1024, [&](auto val) {
+        config.max_size = val;
+    });
+}
+
 auto load_configuration(int argc, char const* argv[])
     -> config
 {
@@ -136,6 +262,10 @@ auto load_configuration(int argc, char const* argv[])
         load_logging_config(data, config);
     });
 
+    try_get<toml_table>(data_table, "cache"s, [&config = result.cache](auto& data) {
+        load_cache_config(data, config);
+    });
+
     // Now we bind to 0.0.0.0 and this must know own remote name or ip address.
     // However there is no standard way in asio to enumerate all interfaces to listen
     // so the best way is to rely on DNS working.
@@ -1,6 +1,7 @@
 #ifndef EEMS_CONFIG_H
 #define EEMS_CONFIG_H
 
+#include "cache_config.h"
 #include "data_config.h"
 #include "logging_config.h"
 #include "server_config.h"
@@ -15,6 +16,7 @@ struct config
     store_config db;
     server_config server;
     logging_config logging;
+    cache_config cache;
 };
 
 auto load_configuration(int argc, char const* argv[])
@@ -1,20 +1,42 @@
 #include "content_service.h"
 
 #include "as_result.h"
+#include "byte_ranges.h"
+#include "file_validators.h"
+#include "page_cache.h"
+#include "run_on.h"
+#include "socket_tuning.h"
 #include "spirit.h"
+#include "stream_pipeline.h"
+#include "time_seek.h"
 #include "store/fb_converters.h"
 
 #include <boost/asio/experimental/as_single.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/random_access_file.hpp>
+#include <boost/asio/read_at.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/beast/core/file.hpp>
+#include <boost/beast/core/string.hpp>
 #include <boost/beast/http/buffer_body.hpp>
 #include <boost/beast/http/write.hpp>
 #include <boost/beast/version.hpp>
-#include <boost/fusion/adapted/std_tuple.hpp>
-#include <boost/fusion/include/std_tuple.hpp>
 #include <fmt/ostream.h>
 #include <fmt/std.h>
 #include <spdlog/spdlog.h>
 
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 namespace boost::beast::http
 {
 template <bool isRequest, class Body, class Fields>
@@ -24,159 +46,673 @@ serializer(message<isRequest, Body, Fields> const&) -> serializer<isRequest, Bod
 namespace eems
 {
 
-auto content_service::create_response(fs::path const& sub_path, http_request const& req)
-    -> std::tuple<http::response<http::buffer_body>, beast::file, std::uintmax_t>
+namespace
 {
-    int64_t resource_id;
-    if (!parse(std::basic_string_view{sub_path.c_str()}, x3::int64, resource_id))
+// Limits how long a single sendfile(2) call can keep the event loop busy.
+// Each chunk is made sure to be in the page cache before it's sent.
+constexpr std::size_t zero_copy_chunk{1024 * 1024};
+// io_uring reads don't block the event loop, so more buffers can be read ahead.
+constexpr std::size_t uring_queue_depth{4};
+// Logical block size which satisfies O_DIRECT on common file systems.
+constexpr std::uint64_t direct_io_alignment{4096};
+
+// Returns errno of the failed read, ENODATA if the file is shorter than expected.
+inline auto read_fully(int fd, std::uint64_t offset, net::mutable_buffer buffer) -> int
+{
+    auto data = static_cast<char*>(buffer.data());
+    auto left = buffer.size();
+    while (left)
     {
-        throw http_error{http::status::not_found, sub_path.c_str()};
+        auto const read = ::pread(fd, data, left, static_cast<off_t>(offset));
+        if (read < 0 && errno == EINTR)
+            continue;
+        if (read < 0)
+            return errno;
+        if (read == 0)
+            return ENODATA;
+        data += read;
+        offset += read;
+        left -= read;
     }
+    return 0;
+}
 
-    std::tuple<std::optional<std::uintmax_t>, std::optional<std::uintmax_t>> request_range;
-
-    auto range_not_satisfiable = []()
+// O_DIRECT reads must be aligned, so the aligned range around the data is read into a scratch buffer.
+inline auto read_direct(int fd, std::uint64_t offset, net::mutable_buffer buffer) -> int
+{
+    struct aligned_free
     {
-        // TODO: A server generating a 416 (Range Not Satisfiable) response to a
-        //       byte-range request SHOULD send a Content-Range header field with an
-        //       unsatisfied-range value, as in the following example:
-        //         Content-Range: bytes */1234
-        throw http_error{http::status::range_not_satisfiable, ""};
+        auto operator()(std::byte* data) const { std::free(data); }
     };
+    thread_local std::unique_ptr<std::byte, aligned_free> scratch;
+    thread_local std::size_t capacity{0};
 
-    if (auto range_header = req[http::field::range]; !range_header.empty())
+    auto const begin = offset / direct_io_alignment * direct_io_alignment;
+    auto const end = (offset + buffer.size() + direct_io_alignment - 1) / direct_io_alignment * direct_io_alignment;
+    auto const length = static_cast<std::size_t>(end - begin);
+    if (capacity < length)
     {
-        constexpr x3::uint_parser<std::uintmax_t> uint_max;
-        if (!parse(range_header, ("bytes=" >> -uint_max >> '-' >> -uint_max), request_range))
-        {
-            range_not_satisfiable();
-        }
+        scratch.reset(static_cast<std::byte*>(std::aligned_alloc(direct_io_alignment, length)));
+        capacity = scratch ? length : 0;
+        if (!scratch)
+            return ENOMEM;
     }
 
-    auto [resource, res_buf] = store_service_.get_resource(resource_id);
-    if (!resource || !resource->location())
+    // The last block may be short at the end of the file.
+    auto const needed = offset + buffer.size() - begin;
+    std::size_t done = 0;
+    while (done < needed)
     {
-        throw http_error{http::status::not_found, sub_path.c_str()};
+        auto const read = ::pread(fd, scratch.get() + done, length - done, static_cast<off_t>(begin + done));
+        if (read < 0 && errno == EINTR)
+            continue;
+        if (read < 0)
+            return errno;
+        if (read == 0)
+            return ENODATA;
+        done += read;
     }
+    std::memcpy(buffer.data(), scratch.get() + (offset - begin), buffer.size());
+    return 0;
+}
 
-    auto location = as_cstring<fs::path::value_type>(*resource->location());
-    spdlog::debug("Serving {} (from {})", sub_path, location);
-
-    std::tuple<http::response<http::buffer_body>, beast::file, std::uintmax_t> result{};
-
-    auto& [resp, file, size] = result;
+// Switches the file to O_DIRECT if the policy wants it for a file of this size.
+inline auto use_direct_io(beast::file& file, page_cache_config const& page_cache) -> bool
+{
+    if (!page_cache.direct_io_min_size)
+        return false;
     beast::error_code ec;
+    if (auto const size = file.size(ec); ec || size < page_cache.direct_io_min_size)
+        return false;
 
-    auto internal_server_error = [&ec]()
+    auto const flags = ::fcntl(file.native_handle(), F_GETFL);
+    if (flags < 0 || ::fcntl(file.native_handle(), F_SETFL, flags | O_DIRECT) < 0)
     {
-        throw http_error{http::status::internal_server_error, ec.message().c_str()};
+        spdlog::debug("O_DIRECT is not supported: {}", std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Reports read data to the advisor.
+inline auto advised(chunk_reader read, read_advisor& advisor) -> chunk_reader
+{
+    return [read = std::move(read), &advisor](std::uint64_t offset, net::mutable_buffer buffer) -> net::awaitable<void>
+    {
+        co_await read(offset, buffer);
+        advisor.advance(offset + buffer.size());
     };
+}
 
-    file.open(location, beast::file_mode::scan, ec);
-    if (ec == beast::errc::no_such_file_or_directory)
+// Renderers may tell they're downloading, otherwise a transfer is taken for playback until the scheduler sees it
+// running ahead of the media's bitrate.
+inline auto get_transfer_priority(http_request const& req) -> transfer_priority
+{
+    return beast::iequals(req["transferMode.dlna.org"], "Background") ? transfer_priority::bulk : transfer_priority::real_time;
+}
+
+// Headers are already sent, so a failure while sending the body can only end the connection.
+auto send_or_close(tcp_stream& stream, bandwidth_scheduler::transfer& transfer, chunk_reader read,
+                   std::uint64_t offset, std::uintmax_t size, pipeline_limits const& limits = {})
+    -> net::awaitable<bool>
+{
+    beast::error_code write_error;
+    try
+    {
+        write_error = co_await send_pipelined(stream, std::move(read), offset, size, limits, [&transfer](std::size_t bytes)
+                                              { return transfer.consume(bytes); });
+    }
+    catch (boost::system::system_error const& e)
     {
-        throw http_error{http::status::not_found, sub_path.c_str()};
+        spdlog::error("Reading file failed: {}", e.what());
+        stream.close();
+        co_return false;
     }
-    else if (ec)
+    if (write_error)
     {
-        internal_server_error();
+        // Players drop the connection on every seek.
+        spdlog::debug("Sending file stopped: {}", write_error.message());
+        stream.close();
+        co_return false;
     }
+    co_return true;
+}
+}
+
+auto content_service::create_response(http_request const& req, file_validators const& validators, std::string_view mime_type,
+                                      std::string_view dlna_features, time_seek_range const* time_seek)
+    -> std::tuple<http::response<http::buffer_body, http_fields>, std::vector<byte_range>, std::optional<multipart_ranges>>
+{
+    // The header is allocated from the pool of the connection, like the request's.
+    std::tuple<http::response<http::buffer_body, http_fields>, std::vector<byte_range>, std::optional<multipart_ranges>> result{
+        http::response<http::buffer_body, http_fields>{std::piecewise_construct, std::make_tuple(), std::make_tuple(req.get_allocator())},
+        {}, {}};
+
+    auto& [resp, ranges, multipart] = result;
 
     resp.version(req.version());
+    resp.result(http::status::ok);
     resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
     resp.set(http::field::accept_ranges, "bytes");
     resp.keep_alive(req.keep_alive());
+    resp.set(http::field::etag, validators.etag());
+    resp.set(http::field::last_modified, validators.last_modified());
+    // DLNA clients ask for a transfer mode and expect it back, strict ones don't seek without the features.
+    if (auto const mode = req["transferMode.dlna.org"]; !mode.empty())
+    {
+        resp.set("transferMode.dlna.org", mode);
+    }
+    else
+    {
+        auto const is_media = mime_type.starts_with("video/") || mime_type.starts_with("audio/");
+        resp.set("transferMode.dlna.org", is_media ? "Streaming" : "Interactive");
+    }
+    if (!dlna_features.empty())
+    {
+        resp.set("contentFeatures.dlna.org", dlna_features);
+    }
 
-    size = file.size(ec);
-    if (ec)
+    if (is_not_modified(req, validators))
+    {
+        // The client (e.g. revalidating its artwork cache) already has it.
+        resp.result(http::status::not_modified);
+        return result;
+    }
+
+    auto const file_size = validators.size;
+    if (time_seek)
     {
-        internal_server_error();
+        // DLNA answers time seeks with 200, the range is described by its own header.
+        ranges.push_back(time_seek->bytes);
+        resp.set("TimeSeekRange.dlna.org", format_time_seek_range(*time_seek, file_size));
+        if (!mime_type.empty())
+        {
+            resp.set(http::field::content_type, mime_type);
+        }
+        resp.content_length(time_seek->bytes.size);
+        return result;
     }
-    if (get<0>(request_range) || get<1>(request_range))
+
+    // A resumed download only continues from its partial copy when the file didn't change, otherwise it gets the whole file.
+    auto requested = is_range_allowed(req, validators) ? parse_byte_ranges(req[http::field::range], file_size)
+                                                       : std::vector<byte_range>{};
+    if (!requested)
+    {
+        resp.result(http::status::range_not_satisfiable);
+        resp.set(http::field::content_range, fmt::format("bytes */{}", file_size));
+        resp.content_length(0);
+        return result;
+    }
+
+    ranges = std::move(*requested);
+    if (ranges.empty())
+    {
+        ranges.push_back({0, file_size});
+    }
+    else
     {
         resp.result(http::status::partial_content);
+    }
 
-        auto& [first, last] = request_range;
-        if (first && last && *first > *last)
+    if (ranges.size() == 1)
+    {
+        auto const [offset, size] = ranges.front();
+        if (resp.result() == http::status::partial_content)
         {
-            range_not_satisfiable();
+            resp.set(http::field::content_range, fmt::format("bytes {}-{}/{}", offset, offset + size - 1, file_size));
         }
+        if (!mime_type.empty())
+        {
+            resp.set(http::field::content_type, mime_type);
+        }
+        resp.content_length(size);
+    }
+    else
+    {
+        multipart = make_multipart_ranges(ranges, mime_type.empty() ? "application/octet-stream" : mime_type, file_size);
+        resp.set(http::field::content_type, multipart->content_type);
+        resp.content_length(multipart->content_length);
+    }
+
+    return result;
+}
+
+auto content_service::open_file(fs::path location, std::string mime_type, std::string dlna_features, std::chrono::milliseconds duration,
+                                std::uintmax_t offset)
+    -> net::awaitable<std::tuple<open_file_cache::entry_ptr, beast::error_code>>
+{
+    return run_on(io_pool_, [location = std::move(location), mime_type = std::move(mime_type), dlna_features = std::move(dlna_features), duration,
+                             offset]() mutable
+                  {
+                      std::tuple<open_file_cache::entry_ptr, beast::error_code> result{};
+                      auto& [opened, ec] = result;
+                      auto entry = std::make_shared<open_file_cache::entry>();
+                      entry->file.open(location.c_str(), beast::file_mode::scan, ec);
+                      if (ec)
+                          return result;
+                      struct stat st;
+                      if (::fstat(entry->file.native_handle(), &st) < 0)
+                      {
+                          ec = {errno, boost::system::system_category()};
+                          return result;
+                      }
+                      entry->validators = {
+                          .inode = st.st_ino,
+                          .size = static_cast<std::uintmax_t>(st.st_size),
+                          .mtime = st.st_mtim.tv_sec * std::int64_t{1'000'000'000} + st.st_mtim.tv_nsec,
+                      };
+                      entry->location = std::move(location);
+                      entry->mime_type = std::move(mime_type);
+                      entry->dlna_features = std::move(dlna_features);
+                      entry->duration = duration;
+                      // Touch the data, so a sleeping drive spins up here rather than in the event loop.
+                      char probe;
+                      if (offset < entry->validators.size && ::pread(entry->file.native_handle(), &probe, 1, static_cast<off_t>(offset)) < 0)
+                      {
+                          ec = {errno, boost::system::system_category()};
+                          return result;
+                      }
+                      opened = std::move(entry);
+                      return result;
+                  });
+}
+
+auto content_service::find_time_seek_range(Resource const* resource, std::string_view header, std::uintmax_t file_size) const
+    -> io_result<time_seek_range>
+{
+    auto const requested = parse_npt_range(header);
+    if (!requested)
+    {
+        spdlog::debug("Invalid TimeSeekRange: {}", header);
+        return make_http_error(http::status::bad_request);
+    }
+    if (!resource || !resource->seek_index())
+    {
+        // DLNA wants 406 when time seeking is not supported for the resource.
+        return make_http_error(http::status::not_acceptable);
+    }
+    auto range = eems::find_time_seek_range(*requested, *resource, file_size);
+    if (!range)
+    {
+        return make_http_error(http::status::range_not_satisfiable);
+    }
+    return *range;
+}
+
+auto content_service::get_page_cache_policy(fs::path const& location) const
+    -> page_cache_config const*
+{
+    for (auto const& library : data_config_.content_directories)
+    {
+        auto const relative = location.lexically_relative(library.path);
+        if (!relative.empty() && *relative.begin() != "..")
+            return &library.page_cache;
+    }
+    return nullptr;
+}
+
+auto content_service::send_file(tcp_stream& stream, bandwidth_scheduler::transfer& transfer, beast::file& file, std::uint64_t offset, std::uintmax_t size,
+                                page_cache_config const* page_cache)
+    -> net::awaitable<bool>
+{
+    if (page_cache && use_direct_io(file, *page_cache))
+    {
+        // Neither sendfile nor io_uring reads into aligned buffers.
+        co_return co_await send_file_buffered(stream, transfer, file, offset, size, nullptr, true);
+    }
+#ifdef BOOST_ASIO_HAS_FILE
+    if (server_config_.io_uring)
+    {
+        co_return co_await send_file_uring(stream, transfer, file, offset, size, page_cache);
+    }
+#endif
+    if (server_config_.zero_copy)
+    {
+        co_return co_await send_file_zero_copy(stream, transfer, file, offset, size, page_cache);
+    }
+    co_return co_await send_file_buffered(stream, transfer, file, offset, size, page_cache);
+}
+
+auto content_service::send_file_uring(tcp_stream& stream, bandwidth_scheduler::transfer& transfer, beast::file& file, std::uint64_t offset, std::uintmax_t size,
+                                      page_cache_config const* page_cache)
+    -> net::awaitable<bool>
+{
+#ifdef BOOST_ASIO_HAS_FILE
+    // Asio takes ownership of the descriptor.
+    auto const fd = ::dup(file.native_handle());
+    if (fd < 0)
+    {
+        co_return co_await send_file_buffered(stream, transfer, file, offset, size, page_cache);
+    }
+
+    net::random_access_file source{co_await net::this_coro::executor, fd};
+    read_advisor advisor{fd, page_cache, offset};
+    co_return co_await send_or_close(
+        stream, transfer,
+        advised([&source](std::uint64_t offset, net::mutable_buffer buffer) -> net::awaitable<void>
+                { co_await net::async_read_at(source, offset, buffer, net::use_awaitable); },
+                advisor),
+        offset, size, {.depth = uring_queue_depth, .write_timeout = server_config_.write_timeout});
+#else
+    co_return co_await send_file_buffered(stream, transfer, file, offset, size, page_cache);
+#endif
+}
+
+auto content_service::send_file_zero_copy(tcp_stream& stream, bandwidth_scheduler::transfer& transfer, beast::file& file, std::uint64_t offset, std::uintmax_t size,
+                                          page_cache_config const* page_cache)
+    -> net::awaitable<bool>
+{
+#ifdef __linux__
+    using namespace net::experimental::awaitable_operators;
 
-        if (first && *first >= size)
-            range_not_satisfiable();
+    auto& socket = stream.socket();
+    beast::error_code ec;
+    // Writes are driven by socket readiness, so sendfile must not block on a full socket buffer.
+    socket.native_non_blocking(true, ec);
+    // Positional, the file may be shared with other requests.
+    auto position = static_cast<off_t>(offset);
+    if (ec)
+    {
+        co_return co_await send_file_buffered(stream, transfer, file, offset, size, page_cache);
+    }
 
-        if (!last)
+    net::steady_timer timer{co_await net::this_coro::executor};
+    read_advisor advisor{file.native_handle(), page_cache, offset};
+    auto sent_any = false;
+    auto cached_until = position;
+    while (size)
+    {
+        auto const chunk = static_cast<std::size_t>(std::min<std::uintmax_t>(size, zero_copy_chunk));
+        // sendfile would stall the event loop while it waits for the drive, so what isn't in
+        // the page cache yet is read on the pool first.
+        if (position + static_cast<off_t>(chunk) > cached_until)
         {
-            // Request for last bytes
-            last = size - 1;
+            if (!is_cached(file.native_handle(), position, chunk))
+            {
+                co_await run_on(io_pool_, [fd = file.native_handle(), position, chunk]()
+                                { load_into_cache(fd, position, chunk); });
+            }
+            cached_until = position + static_cast<off_t>(chunk);
         }
-        if (!first)
+        auto const sent = ::sendfile(socket.native_handle(), file.native_handle(), &position, chunk);
+        if (sent > 0)
         {
-            // Request till the end
-            *last = std::min(size, *last);
-            first = size - *last;
+            size -= sent;
+            sent_any = true;
+            advisor.advance(position);
+            co_await transfer.consume(sent);
+            continue;
         }
-        resp.set(http::field::content_range, fmt::format("bytes {}-{}/{}", *first, *last, size));
-        size = *last - *first + 1;
-        file.seek(*first, ec);
-        if (ec)
+        if (sent == 0)
         {
-            internal_server_error();
+            spdlog::error("File ended {} bytes early", size);
+            stream.close();
+            co_return false;
         }
-    }
-    resp.content_length(size);
 
-    return result;
+        auto const error = errno;
+        if (error == EAGAIN || error == EWOULDBLOCK)
+        {
+            timer.expires_after(server_config_.write_timeout);
+            auto const writable = co_await (socket.async_wait(net::socket_base::wait_write, as_result(net::use_awaitable)) ||
+                                            timer.async_wait(as_result(net::use_awaitable)));
+            if (writable.index() != 0 || !std::get<0>(writable))
+            {
+                spdlog::debug("Client stopped reading");
+                stream.close();
+                co_return false;
+            }
+        }
+        else if (error == EINTR)
+        {
+            continue;
+        }
+        else if (!sent_any && (error == EINVAL || error == ENOSYS || error == EOPNOTSUPP))
+        {
+            // The file system doesn't support it and nothing was sent yet.
+            spdlog::debug("sendfile is not supported: {}, falling back to buffered", std::strerror(error));
+            co_return co_await send_file_buffered(stream, transfer, file, offset, size, page_cache);
+        }
+        else
+        {
+            spdlog::error("sendfile failed: {}", std::strerror(error));
+            stream.close();
+            co_return false;
+        }
+    }
+    co_return true;
+#else
+    co_return co_await send_file_buffered(stream, transfer, file, offset, size, page_cache);
+#endif
 }
 
-auto content_service::handle_request(tcp_stream& stream, http_request&& req, fs::path sub_path)
+auto content_service::send_file_buffered(tcp_stream& stream, bandwidth_scheduler::transfer& transfer, beast::file& file, std::uint64_t offset, std::uintmax_t size,
+                                         page_cache_config const* page_cache, bool direct_io)
     -> net::awaitable<bool>
 {
-    auto [response, file, size] = create_response(sub_path, req);
+    read_advisor advisor{file.native_handle(), page_cache, offset};
+    // Reads are done on the pool, so a slow drive doesn't stall other connections.
+    co_return co_await send_or_close(
+        stream, transfer,
+        advised([this, fd = file.native_handle(), direct_io](std::uint64_t offset, net::mutable_buffer buffer) -> net::awaitable<void>
+                {
+                    auto const error = co_await run_on(io_pool_, [fd, offset, buffer, direct_io]() -> int
+                                                       { return direct_io ? read_direct(fd, offset, buffer) : read_fully(fd, offset, buffer); });
+                    if (error)
+                    {
+                        throw boost::system::system_error{error, boost::system::system_category(), "pread"};
+                    }
+                },
+                advisor),
+        offset, size, {.write_timeout = server_config_.write_timeout});
+}
+
+auto content_service::handle_request(tcp_stream& stream, http_request& req, std::string_view sub_path)
+    -> net::awaitable<io_result<bool>>
+{
+    int64_t resource_id;
+    if (!parse(sub_path, x3::int64, resource_id))
+    {
+        co_return make_http_error(http::status::not_found);
+    }
+
+    // A file served recently is still open, then neither the store nor the file system is touched,
+    // and its details are used in place instead of being copied.
+    auto const hit = files_.get(resource_id);
+    auto opened = hit;
+    std::optional<prefix_cache::entry> cached;
+    store_service::resource_result stored{};
+    fs::path stored_location;
+    std::string_view mime_type;
+    std::string_view dlna_features;
+    std::chrono::milliseconds duration{0};
+    auto populate_cache = false;
+    if (hit)
+    {
+        mime_type = hit->mime_type;
+        dlna_features = hit->dlna_features;
+        duration = hit->duration;
+    }
+    else
+    {
+        stored = co_await store_service_.get_resource_async(resource_id);
+        auto const* resource = stored.resource;
+        if (!resource || !resource->location())
+        {
+            co_return make_http_error(http::status::not_found);
+        }
+        stored_location = fs::path{as_cstring<fs::path::value_type>(*resource->location())};
+        if (resource->mime_type())
+        {
+            mime_type = as_string_view<char>(*resource->mime_type());
+        }
+        if (resource->dlna_features())
+        {
+            dlna_features = as_string_view<char>(*resource->dlna_features());
+        }
+        duration = std::chrono::milliseconds(resource->duration());
+
+        // When the beginning (or the end) of the file is in the cache, the file itself is
+        // not touched until the cached part is sent, so a sleeping drive has time to spin up.
+        cached = cache_.open(stored_location);
+        if (!cached)
+        {
+            beast::error_code ec;
+            std::tie(opened, ec) = co_await open_file(stored_location, std::string{mime_type}, std::string{dlna_features}, duration, 0);
+            if (ec)
+            {
+                spdlog::debug("Can't open {}: {}", stored_location, ec.message());
+                co_return make_http_error(ec == beast::errc::no_such_file_or_directory ? http::status::not_found
+                                                                                      : http::status::internal_server_error);
+            }
+            files_.put(resource_id, opened);
+            populate_cache = cache_.enabled();
+        }
+    }
+    auto const& location = hit ? hit->location : stored_location;
+    auto const is_video = mime_type.starts_with("video/");
+    // Only bulk video is kept out of the page cache, artwork and subtitles are small and hot.
+    auto const* page_cache = is_video ? get_page_cache_policy(location) : nullptr;
+    spdlog::debug("Serving {} (from {})", sub_path, location);
 
+    auto const& validators = cached ? cached->validators() : opened->validators;
+    // Renderers which can only seek by time ask for a play time range instead of bytes.
+    std::optional<time_seek_range> time_seek;
+    if (auto const npt = req["TimeSeekRange.dlna.org"]; !npt.empty())
+    {
+        // The open file cache doesn't keep the seek index, which is only needed for time seeks.
+        if (!stored.resource)
+        {
+            stored = co_await store_service_.get_resource_async(resource_id);
+        }
+        auto found = find_time_seek_range(stored.resource, npt, validators.size);
+        if (!found)
+        {
+            co_return found.error();
+        }
+        time_seek = found.value();
+    }
+
+    auto [response, ranges, multipart] = create_response(req, validators, mime_type, dlna_features, time_seek ? &*time_seek : nullptr);
+
+    // The header leaves together with the beginning of the body, full frames are sent as they fill up,
+    // the rest when the response is complete.
+    socket_cork const cork{stream.socket()};
     {
         http::serializer sr{response};
 
-        co_await http::async_write_header(stream, sr);
         // Don't use serializer because it throws need buffer exception (in co_await).
+        if (auto const written = co_await http::async_write_header(stream, sr); !written)
+        {
+            co_return written.error();
+        }
     }
-    if (req.method() == http::verb::head)
+    if (req.method() == http::verb::head || ranges.empty())
     {
-        // No need to send body for HEAD request.
+        // No need to send body for HEAD request, 304 and 416 don't have one.
         co_return true;
     }
-    // Reuse request's buffer.
-    auto& buffer = req.body();
-    buffer.consume(buffer.size());
+    if (populate_cache && is_video)
+    {
+        // Disk is awake now, so it's cheap to prepare for the next time.
+        net::post(io_pool_, [&cache = cache_, location]()
+                  { cache.populate(location); });
+    }
 
-    // TODO: Look at llfio's and its reading...
-    beast::error_code ec;
-    do
+    beast::error_code endpoint_ec;
+    auto const media_rate = duration.count() > 0 ? validators.size * 1000 / duration.count() : 0;
+    auto const transfer = bandwidth_.start(stream.socket().remote_endpoint(endpoint_ec).address(), resource_id,
+                                           get_transfer_priority(req), media_rate);
+
+    if (multipart)
     {
-        auto produce_buffer = buffer.prepare(std::min<std::uintmax_t>(size, 4096u));
-        if (!produce_buffer.size())
+        // Each part is sent from the prefix cache when it's there, e.g. a player probing the header and the index.
+        for (std::size_t i = 0; i < ranges.size(); ++i)
         {
-            break;
+            auto const [offset, size] = ranges[i];
+            stream.expires_after(server_config_.write_timeout);
+            if (auto const written = co_await net::async_write(stream, net::buffer(multipart->part_headers[i])); !written)
+            {
+                co_return written.error();
+            }
+            if (cached && cached->cached_size(offset, size) == size)
+            {
+                if (!co_await send_file(stream, *transfer, cached->file, cached->cache_offset(offset), size))
+                {
+                    co_return false;
+                }
+                continue;
+            }
+            if (!opened)
+            {
+                beast::error_code ec;
+                std::tie(opened, ec) = co_await open_file(location, std::string{mime_type}, std::string{dlna_features}, duration, offset);
+                if (ec || opened->validators != validators)
+                {
+                    spdlog::error("Cached {} doesn't match {}: {}", sub_path, location, ec ? ec.message() : "file changed");
+                    cache_.invalidate(location);
+                    stream.close();
+                    co_return false;
+                }
+                files_.put(resource_id, opened);
+            }
+            if (!co_await send_file(stream, *transfer, opened->file, offset, size, page_cache))
+            {
+                co_return false;
+            }
         }
-        auto const read_bytes = file.read(produce_buffer.data(), produce_buffer.size(), ec);
-        if (ec)
+        stream.expires_after(server_config_.write_timeout);
+        if (auto const written = co_await net::async_write(stream, net::buffer(multipart->closing)); !written)
         {
-            spdlog::error("Read failed: {}", fmt::streamed(ec));
-            stream.close();
-            co_return false;
+            co_return written.error();
         }
-        buffer.commit(read_bytes);
+        co_return true;
+    }
 
-        auto const written_bytes = co_await net::async_write(stream, buffer.data(),
-                                                             as_result(net::use_awaitable)); // TODO: use_async_result
-        if (!written_bytes)
+    auto [offset, size] = ranges.front();
+    if (cached)
+    {
+        auto const cached_size = cached->cached_size(offset, size);
+        if (cached_size == size)
         {
+            co_return co_await send_file(stream, *transfer, cached->file, cached->cache_offset(offset), size);
+        }
+
+        // Open the file while the cached part is being sent and continue from it.
+        std::tuple<open_file_cache::entry_ptr, beast::error_code> source;
+        if (cached_size)
+        {
+            using namespace net::experimental::awaitable_operators;
+            spdlog::debug("Sending {} bytes of {} from cache", cached_size, sub_path);
+            bool sent;
+            std::tie(sent, source) = co_await (send_file(stream, *transfer, cached->file, cached->cache_offset(offset), cached_size) &&
+                                               open_file(location, std::string{mime_type}, std::string{dlna_features}, duration, offset + cached_size));
+            if (!sent)
+            {
+                co_return false;
+            }
+        }
+        else
+        {
+            source = co_await open_file(location, std::string{mime_type}, std::string{dlna_features}, duration, offset);
+        }
+
+        auto& [source_file, open_ec] = source;
+        if (open_ec || source_file->validators != validators)
+        {
+            // Headers (with the validators) are already sent, so the only option is to drop the connection.
+            spdlog::error("Cached {} doesn't match {}: {}", sub_path, location, open_ec ? open_ec.message() : "file changed");
+            cache_.invalidate(location);
+            stream.close();
             co_return false;
         }
-        buffer.consume(written_bytes.value());
-        size -= written_bytes.value();
-    } while (true);
-    co_return true;
+        opened = std::move(source_file);
+        files_.put(resource_id, opened);
+        offset += cached_size;
+        size -= cached_size;
+    }
+
+    co_return co_await send_file(stream, *transfer, opened->file, offset, size, page_cache);
 }
 
 }
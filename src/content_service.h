@@ -1,32 +1,115 @@
 #ifndef EEMS_CONTENT_SERVICE_H
 #define EEMS_CONTENT_SERVICE_H
 
+#include "bandwidth_scheduler.h"
+#include "byte_ranges.h"
+#include "cache_config.h"
+#include "data_config.h"
+#include "file_validators.h"
+#include "frame_pool.h"
 #include "fs.h"
 #include "http_messages.h"
+#include "open_file_cache.h"
+#include "prefix_cache.h"
+#include "server_config.h"
 #include "store/store_service.h"
+#include "time_seek.h"
 
+#include <boost/asio/thread_pool.hpp>
 #include <boost/beast/core/file.hpp>
 #include <boost/beast/http/buffer_body.hpp>
+#include <chrono>
 
 namespace eems
 {
+// Every range request awaits several coroutines of the service.
+class content_service;
+template <>
+inline constexpr bool pooled_frames<content_service> = true;
+
 class content_service
 {
 public:
-    explicit content_service(store_service& store_service)
-        : store_service_{store_service}
+    explicit content_service(store_service& store_service,
+                             bandwidth_scheduler& bandwidth,
+                             prefix_cache& cache,
+                             net::thread_pool& io_pool,
+                             server_config const& server_config,
+                             data_config const& data_config)
+        : store_service_{store_service},
+          server_config_{server_config},
+          data_config_{data_config},
+          cache_{cache},
+          bandwidth_{bandwidth},
+          io_pool_{io_pool}
     {
     }
 
-    auto handle_request(tcp_stream& stream, http_request&& req, fs::path sub_path)
-        -> net::awaitable<bool>;
+    // False when the connection can't be used anymore, an HTTP status error when the request is to be answered with it.
+    auto handle_request(tcp_stream& stream, http_request& req, std::string_view sub_path)
+        -> net::awaitable<io_result<bool>>;
+
+    // Background maintenance of open files.
+    auto run() -> net::awaitable<void>
+    {
+        return files_.run();
+    }
+
+    auto active_transfers() const -> std::vector<bandwidth_scheduler::transfer_stats>
+    {
+        return bandwidth_.stats();
+    }
 
 private:
-    auto create_response(fs::path const& sub_path, http_request const& req)
-        -> std::tuple<http::response<http::buffer_body>, beast::file, std::uintmax_t>;
+    // Response header with the ranges to send (none for 304 and 416), multipart framing when there are several of them.
+    auto create_response(http_request const& req, file_validators const& validators, std::string_view mime_type,
+                         std::string_view dlna_features, time_seek_range const* time_seek)
+        -> std::tuple<http::response<http::buffer_body, http_fields>, std::vector<byte_range>, std::optional<multipart_ranges>>;
+
+    // Byte range of the TimeSeekRange.dlna.org header in the resource, or the status to answer when it can't be satisfied.
+    auto find_time_seek_range(Resource const* resource, std::string_view header, std::uintmax_t file_size) const
+        -> io_result<time_seek_range>;
+
+    // Page cache policy of the library with the file, if any.
+    auto get_page_cache_policy(fs::path const& location) const
+        -> page_cache_config const*;
+
+    // Sends size bytes from the offset. Reads are positional, so the file can be shared.
+    auto send_file(tcp_stream& stream, bandwidth_scheduler::transfer& transfer, beast::file& file, std::uint64_t offset, std::uintmax_t size,
+                   page_cache_config const* page_cache = nullptr)
+        -> net::awaitable<bool>;
+
+    // Reads on the I/O pool, with O_DIRECT set on the file it reads through aligned buffers.
+    auto send_file_buffered(tcp_stream& stream, bandwidth_scheduler::transfer& transfer, beast::file& file, std::uint64_t offset, std::uintmax_t size,
+                            page_cache_config const* page_cache, bool direct_io = false)
+        -> net::awaitable<bool>;
+
+    // Falls back to send_file_buffered() when the file can't be sent with sendfile(2).
+    auto send_file_zero_copy(tcp_stream& stream, bandwidth_scheduler::transfer& transfer, beast::file& file, std::uint64_t offset, std::uintmax_t size,
+                             page_cache_config const* page_cache)
+        -> net::awaitable<bool>;
+
+    // Reads through io_uring, several chunks ahead of the one being written.
+    auto send_file_uring(tcp_stream& stream, bandwidth_scheduler::transfer& transfer, beast::file& file, std::uint64_t offset, std::uintmax_t size,
+                         page_cache_config const* page_cache)
+        -> net::awaitable<bool>;
+
+    // Opens the file on the I/O pool and reads a byte at the offset to wake up the drive.
+    auto open_file(fs::path location, std::string mime_type, std::string dlna_features, std::chrono::milliseconds duration,
+                   std::uintmax_t offset)
+        -> net::awaitable<std::tuple<open_file_cache::entry_ptr, beast::error_code>>;
 
 private:
     store_service& store_service_;
+    server_config const& server_config_;
+    data_config const& data_config_;
+    // Shared by all shards, they use the same directory.
+    prefix_cache& cache_;
+    open_file_cache files_;
+    // Shared by all shards, the limits are for the whole server.
+    bandwidth_scheduler& bandwidth_;
+    // Runs blocking file operations, which may take seconds when a drive spins up. Shared by all shards.
+    net::thread_pool& io_pool_;
 };
 
 }
@@ -3,6 +3,8 @@
 
 #include "fs.h"
 
+#include <cstdint>
+
 #include <variant>
 #include <vector>
 
@@ -15,10 +17,22 @@ struct movies_library_config
     bool use_collections{true};
 };
 
+// How streaming videos of the library uses the page cache.
+struct page_cache_config
+{
+    // How far ahead of the playhead the kernel is asked to read.
+    std::uintmax_t read_ahead{8 * 1024 * 1024};
+    // Drop data which was already read, so big videos don't evict the metadata.
+    bool drop_behind{true};
+    // Videos at least this big bypass the page cache completely (O_DIRECT), disabled when 0.
+    std::uintmax_t direct_io_min_size{0};
+};
+
 struct directory_config
 {
     fs::path path;
     std::variant<movies_library_config> scanner_config;
+    page_cache_config page_cache;
 };
 
 struct data_config
@@ -0,0 +1,111 @@
+#include "file_validators.h"
+
+#include <array>
+#include <chrono>
+#include <date/date.h>
+#include <fmt/format.h>
+#include <iterator>
+#include <optional>
+#include <sstream>
+
+namespace eems
+{
+
+namespace
+{
+// IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+constexpr auto http_date_format = "%a, %d %b %Y %H:%M:%S GMT";
+
+inline auto mtime_seconds(file_validators const& validators) -> date::sys_seconds
+{
+    return std::chrono::floor<std::chrono::seconds>(date::sys_time<std::chrono::nanoseconds>{std::chrono::nanoseconds{validators.mtime}});
+}
+
+auto parse_http_date(std::string_view text) -> std::optional<date::sys_seconds>
+{
+    // Obsolete formats (RFC 850, asctime) are not worth it, such clients just get the whole file.
+    std::istringstream in{std::string{text}};
+    date::sys_seconds result;
+    in >> date::parse(http_date_format, result);
+    if (in.fail())
+        return std::nullopt;
+    return result;
+}
+
+// Weak comparison (RFC 7232 2.3.2) against each entity tag in the list.
+auto matches_any(std::string_view list, std::string_view etag) -> bool
+{
+    if (auto const first = list.find_first_not_of(" \t"); first != list.npos && list[first] == '*')
+        return true;
+
+    for (auto begin = list.find('"'); begin != list.npos; begin = list.find('"', begin))
+    {
+        auto const end = list.find('"', begin + 1);
+        if (end == list.npos)
+            break;
+        if (list.substr(begin, end - begin + 1) == etag)
+            return true;
+        begin = end + 1;
+    }
+    return false;
+}
+}
+
+auto file_validators::etag() const -> validator_string
+{
+    validator_string result;
+    fmt::format_to(std::back_inserter(result), "\"{:x}-{:x}-{:x}\"", inode, size, static_cast<std::uint64_t>(mtime));
+    return result;
+}
+
+auto file_validators::last_modified() const -> validator_string
+{
+    // Same as http_date_format, but without the streams and the locale.
+    constexpr std::array<char const*, 7> weekdays{"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    constexpr std::array<char const*, 12> months{"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    auto const time = mtime_seconds(*this);
+    auto const days = std::chrono::floor<date::days>(time);
+    auto const ymd = date::year_month_day{days};
+    auto const hms = date::hh_mm_ss{time - days};
+    validator_string result;
+    fmt::format_to(std::back_inserter(result), "{}, {:02} {} {:04} {:02}:{:02}:{:02} GMT",
+                   weekdays[date::weekday{days}.c_encoding()], static_cast<unsigned>(ymd.day()),
+                   months[static_cast<unsigned>(ymd.month()) - 1], static_cast<int>(ymd.year()),
+                   hms.hours().count(), hms.minutes().count(), hms.seconds().count());
+    return result;
+}
+
+auto is_not_modified(http_request const& req, file_validators const& validators) -> bool
+{
+    if (req.method() != http::verb::get && req.method() != http::verb::head)
+        return false;
+
+    if (auto const if_none_match = req[http::field::if_none_match]; !if_none_match.empty())
+    {
+        return matches_any(if_none_match, validators.etag());
+    }
+    if (auto const if_modified_since = req[http::field::if_modified_since]; !if_modified_since.empty())
+    {
+        auto const since = parse_http_date(if_modified_since);
+        return since && mtime_seconds(validators) <= *since;
+    }
+    return false;
+}
+
+auto is_range_allowed(http_request const& req, file_validators const& validators) -> bool
+{
+    auto const if_range = req[http::field::if_range];
+    if (if_range.empty())
+        return true;
+
+    // Strong comparison, a weak tag never matches.
+    if (if_range.starts_with('"') || if_range.starts_with("W/"))
+        return if_range == std::string_view{validators.etag()};
+
+    // A date only validates when it's exactly the modification time.
+    auto const date = parse_http_date(if_range);
+    return date && *date == mtime_seconds(validators);
+}
+
+}
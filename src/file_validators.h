@@ -0,0 +1,39 @@
+#ifndef EEMS_FILE_VALIDATORS_H
+#define EEMS_FILE_VALIDATORS_H
+
+#include "http_messages.h"
+
+#include <boost/beast/core/static_string.hpp>
+#include <cstdint>
+
+namespace eems
+{
+
+// Formatted without allocating, the longest one is an entity tag of three 64-bit numbers.
+using validator_string = beast::static_string<64>;
+
+// What identifies a version of a served file (RFC 7232).
+struct file_validators
+{
+    std::uint64_t inode{0};
+    std::uintmax_t size{0};
+    // Nanoseconds since the epoch.
+    std::int64_t mtime{0};
+
+    // Strong entity tag, changes whenever the file is replaced or modified.
+    auto etag() const -> validator_string;
+    // HTTP-date of the modification time.
+    auto last_modified() const -> validator_string;
+
+    auto operator==(file_validators const&) const -> bool = default;
+};
+
+// The client's copy is current: If-None-Match matches, or without it, If-Modified-Since is not older.
+auto is_not_modified(http_request const& req, file_validators const& validators) -> bool;
+
+// The Range header may be used: there's no If-Range, or it matches the current version.
+auto is_range_allowed(http_request const& req, file_validators const& validators) -> bool;
+
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef EEMS_FNV_HASH_H
+#define EEMS_FNV_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace eems
+{
+
+constexpr std::uint64_t fnv_offset_basis = 0xcbf29ce484222325;
+
+// FNV-1a, which is the same between runs and builds, unlike std::hash, so it can name files.
+// Continues from the given hash to combine several values.
+inline auto fnv_hash(void const* data, std::size_t size, std::uint64_t hash = fnv_offset_basis) -> std::uint64_t
+{
+    for (auto const* byte = static_cast<unsigned char const*>(data); size; --size)
+    {
+        hash = (hash ^ *byte++) * 0x100000001b3;
+    }
+    return hash;
+}
+
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include "frame_pool.h"
+
+#include "allocation_stats.h"
+
+#include <array>
+#include <new>
+#include <utility>
+
+namespace eems::frame_pool
+{
+
+namespace
+{
+// Frames are rounded up to size classes, a function's frame always has the same size.
+constexpr std::size_t granularity = 256;
+constexpr std::size_t max_pooled_size = 32 * 1024;
+// Enough for the frames of the connections served by a thread at the same time.
+constexpr std::size_t max_free_frames = 64;
+
+// Frames freed while the thread exits go back to the heap.
+thread_local bool destroyed = false;
+
+struct free_frame
+{
+    free_frame* next;
+};
+
+class thread_pool
+{
+public:
+    thread_pool() = default;
+    thread_pool(thread_pool const&) = delete;
+    auto operator=(thread_pool const&) -> thread_pool& = delete;
+
+    ~thread_pool()
+    {
+        destroyed = true;
+        for (auto* frame : free_)
+        {
+            while (frame)
+                ::operator delete(std::exchange(frame, frame->next));
+        }
+    }
+
+    auto pop(std::size_t size_class) noexcept -> void*
+    {
+        auto*& head = free_[size_class];
+        if (!head)
+            return nullptr;
+        --count_[size_class];
+        return std::exchange(head, head->next);
+    }
+
+    auto push(std::size_t size_class, void* frame) noexcept -> bool
+    {
+        if (count_[size_class] == max_free_frames)
+            return false;
+        ++count_[size_class];
+        free_[size_class] = ::new (frame) free_frame{free_[size_class]};
+        return true;
+    }
+
+private:
+    std::array<free_frame*, max_pooled_size / granularity> free_{};
+    std::array<std::size_t, max_pooled_size / granularity> count_{};
+};
+
+thread_local thread_pool pool;
+
+constexpr auto size_class(std::size_t size) -> std::size_t
+{
+    return (size - 1) / granularity;
+}
+}
+
+auto allocate(std::size_t size) -> void*
+{
+    if (size > max_pooled_size)
+    {
+        count_frame(true);
+        return ::operator new(size);
+    }
+    if (auto* const frame = destroyed ? nullptr : pool.pop(size_class(size)))
+    {
+        count_frame(false);
+        return frame;
+    }
+    count_frame(true);
+    return ::operator new((size_class(size) + 1) * granularity);
+}
+
+auto deallocate(void* frame, std::size_t size) noexcept -> void
+{
+    if (size > max_pooled_size || destroyed || !pool.push(size_class(size), frame))
+        ::operator delete(frame);
+}
+
+}
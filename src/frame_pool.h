@@ -0,0 +1,102 @@
+#ifndef EEMS_FRAME_POOL_H
+#define EEMS_FRAME_POOL_H
+
+#include "net.h"
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/version.hpp>
+#include <coroutine>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace eems
+{
+
+// Coroutine frames of the request path are recycled by the thread which frees them. Asio only recycles frames of
+// up to 1 KiB, while a request awaits several larger ones.
+namespace frame_pool
+{
+auto allocate(std::size_t size) -> void*;
+auto deallocate(void* frame, std::size_t size) noexcept -> void;
+}
+
+// Opts the coroutine members of a class into the frame pool.
+template <typename Class>
+inline constexpr bool pooled_frames = false;
+
+// Asio has no hook for the allocation of a frame, so the pool replaces its promise with a derived one, which relies
+// on Asio's internals. It's only used with the versions of Boost it was checked with, otherwise the frames are
+// Asio's own, recycled by its cache (BOOST_ASIO_RECYCLING_ALLOCATOR_CACHE_SIZE) when they're small enough.
+#if defined(EEMS_POOL_COROUTINE_FRAMES) && BOOST_VERSION >= 107400 && BOOST_VERSION <= 108000
+#define EEMS_HAS_POOLED_FRAMES
+#endif
+
+#ifdef EEMS_HAS_POOLED_FRAMES
+// Asio's promise, with the frame allocated from the pool. It's Asio's frame in all other respects, the promise
+// only adds no state, so a handle to it is also a handle to Asio's promise.
+template <typename T>
+struct pooled_frame : net::detail::awaitable_frame<T, net::any_io_executor>
+{
+    using base_frame = net::detail::awaitable_frame<T, net::any_io_executor>;
+
+    // Awaiting another awaitable suspends with a handle to Asio's promise.
+    template <typename U>
+    struct awaiter
+    {
+        net::awaitable<U, net::any_io_executor> awaited;
+
+        auto await_ready() const noexcept -> bool
+        {
+            return awaited.await_ready();
+        }
+
+        auto await_suspend(std::coroutine_handle<pooled_frame> handle) -> void
+        {
+            awaited.await_suspend(std::coroutine_handle<base_frame>::from_address(handle.address()));
+        }
+
+        auto await_resume() -> U
+        {
+            return awaited.await_resume();
+        }
+    };
+
+    using base_frame::await_transform;
+
+    // Asio's transformation comes first, it throws when the coroutine was cancelled.
+    template <typename U>
+    auto await_transform(net::awaitable<U, net::any_io_executor> awaited) -> awaiter<U>
+    {
+        return {base_frame::await_transform(std::move(awaited))};
+    }
+
+    static auto operator new(std::size_t size) -> void*
+    {
+        return frame_pool::allocate(size);
+    }
+
+    static auto operator delete(void* frame, std::size_t size) noexcept -> void
+    {
+        frame_pool::deallocate(frame, size);
+    }
+};
+#endif
+
+}
+
+#ifdef EEMS_HAS_POOLED_FRAMES
+template <typename T, typename Class, typename... Args>
+    requires eems::pooled_frames<std::remove_const_t<Class>>
+struct std::coroutine_traits<boost::asio::awaitable<T, boost::asio::any_io_executor>, Class&, Args...>
+{
+    using promise_type = eems::pooled_frame<T>;
+
+    // Handles are converted to Asio's promise by address, so both must be laid out alike.
+    static_assert(sizeof(promise_type) == sizeof(typename promise_type::base_frame) &&
+                  alignof(promise_type) == alignof(typename promise_type::base_frame));
+};
+#endif
+
+#endif
@@ -4,6 +4,29 @@
 
 namespace eems
 {
+namespace
+{
+class http_category_impl : public boost::system::error_category
+{
+public:
+    auto name() const noexcept -> char const* override
+    {
+        return "eems.http";
+    }
+
+    auto message(int ev) const -> std::string override
+    {
+        return std::string{http::obsolete_reason(static_cast<http::status>(ev))};
+    }
+};
+}
+
+auto http_category() noexcept -> boost::system::error_category const&
+{
+    static http_category_impl const category;
+    return category;
+}
+
 auto make_error_response(http::status code, std::string_view reason, http_request const& req)
     -> error_response_ptr
 {
@@ -1,7 +1,9 @@
 #ifndef EEMS_HTTP_MESSAGES_H
 #define EEMS_HTTP_MESSAGES_H
 
+#include "as_result.h"
 #include "net.h"
+#include "pool_allocator.h"
 
 #include <boost/asio/use_awaitable.hpp>
 #include <boost/beast/core/flat_buffer.hpp>
@@ -12,20 +14,19 @@
 
 namespace eems
 {
-using http_request = http::request<http::basic_dynamic_body<beast::flat_buffer>>;
-using tcp_stream = net::use_awaitable_t<>::as_default_on_t<beast::tcp_stream>;
+// Connections allocate fields from their own pool and reuse the request, so requests don't allocate once it's warm.
+using http_fields = http::basic_fields<pool_allocator<char>>;
+using http_request = http::request<http::basic_dynamic_body<beast::flat_buffer>, http_fields>;
+// Operations complete with io_result, so a client which disconnects doesn't throw.
+using tcp_stream = as_result_t<net::use_awaitable_t<>>::as_default_on_t<beast::tcp_stream>;
 
-class http_error : public std::runtime_error
+// Errors answered with their HTTP status, which is the value of the code.
+auto http_category() noexcept -> boost::system::error_category const&;
+
+inline auto make_http_error(http::status status) -> boost::system::error_code
 {
-public:
-    http_error(http::status status, char const* message)
-        : runtime_error{message},
-          status{status}
-    {
-    }
-
-    http::status status;
-};
+    return {static_cast<int>(status), http_category()};
+}
 
 using error_response_ptr = std::unique_ptr<http::response<http::basic_dynamic_body<beast::flat_buffer>>>;
 
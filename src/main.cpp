@@ -4,51 +4,128 @@
 #include "scanner/movie_scanner.h"
 #include "server.h"
 
+#include <algorithm>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/signal_set.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <cstdlib>
+#include <deque>
+#include <exception>
 #include <fmt/ranges.h>
 #include <fmt/std.h>
 #include <spdlog/spdlog.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// An event loop with the services which keep per-connection state. The server has one,
+// run by all threads, unless it's sharded: then every thread runs a shard of its own.
+struct shard
+{
+    shard(int concurrency, eems::config& config, eems::store_service& store_service, eems::upnp_service& upnp_service,
+          eems::bandwidth_scheduler& bandwidth, eems::prefix_cache& cache, boost::asio::thread_pool& io_pool,
+          eems::admission_control& admission)
+        : io_context{concurrency},
+          content_service{store_service, bandwidth, cache, io_pool, config.server, config.data},
+          server{io_context, config.server, admission, upnp_service, content_service}
+    {
+    }
+
+    boost::asio::io_context io_context;
+    eems::content_service content_service;
+    eems::server server;
+};
+}
 
 int main(int argc, char const* argv[])
 {
-    auto config = eems::load_configuration(argc, argv);
+    auto config = eems::config{};
+    try
+    {
+        config = eems::load_configuration(argc, argv);
+    }
+    catch (std::exception const& e)
+    {
+        // Logging isn't set up before the configuration is read.
+        fmt::print(stderr, "Invalid configuration: {}\n", e.what());
+        return EXIT_FAILURE;
+    }
 
     spdlog::set_default_logger(std::move(eems::intialize_logging(config.logging)));
 
+    auto const threads = config.server.threads ? config.server.threads : std::max(1u, std::thread::hardware_concurrency());
+    auto const shard_count = config.server.sharded ? threads : 1;
+    auto const threads_per_shard = threads / shard_count;
+
     eems::store_service store_service{};
     eems::upnp_service upnp_service{store_service, config.server};
-    eems::content_service content_service{store_service};
-    eems::server server{config.server, upnp_service, content_service};
+    eems::bandwidth_scheduler bandwidth{config.server};
+    eems::prefix_cache cache{config.cache};
+    // Destroyed after the shards, which use it, and before the cache, which its jobs use.
+    boost::asio::thread_pool io_pool{config.server.io_threads};
+    eems::admission_control admission{config.server};
+    std::deque<shard> shards;
+    for (std::size_t i = 0; i < shard_count; ++i)
+    {
+        shards.emplace_back(static_cast<int>(threads_per_shard), config, store_service, upnp_service, bandwidth, cache,
+                            io_pool, admission);
+    }
     eems::discovery_service discovery_service{config.server};
 
-    if (auto const db_existed = store_service.open_db(config.db); !db_existed)
     {
-        // Fresh DB, scan.
-        eems::movie_scanner movie_scanner{store_service};
-        for (auto& dir : config.data.content_directories)
+        store_service.open_db(config.db);
+        eems::movie_scanner movie_scanner{store_service, config.cache.artwork_path()};
+        auto const& libraries = config.data.content_directories;
+        // Scan the libraries which weren't scanned yet, or resume if the previous run was interrupted.
+        // A library without a journal was never started, even in an existing DB.
+        for (std::size_t i = 0; i < libraries.size(); ++i)
         {
-            spdlog::info("Scanning library: {}", dir.path);
-            std::visit(eems::lambda_visitor{[&path = dir.path, &movie_scanner](eems::movies_library_config const& config)
+            auto const& dir = libraries[i];
+            std::visit(eems::lambda_visitor{[&path = dir.path, &movie_scanner, library = eems::ScanJournalKey{static_cast<int64_t>(i)}](eems::movies_library_config const& config)
                                             {
-                                                movie_scanner.scan_all(path, config);
+                                                movie_scanner.scan_all(library, path, config);
                                             }},
                        dir.scanner_config);
         }
     }
 
-    boost::asio::io_context io_context{1};
+    // Services read the final config, so it's completed before any of them runs.
+    for (auto& shard : shards)
+    {
+        shard.server.listen();
+    }
 
-    boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
+    auto& main_context = shards.front().io_context;
+    boost::asio::signal_set signals(main_context, SIGINT, SIGTERM);
     signals.async_wait([&](auto, auto)
-                       { io_context.stop(); });
+                       {
+                           for (auto& shard : shards)
+                           {
+                               shard.io_context.stop();
+                           }
+                       });
 
-    boost::asio::co_spawn(io_context, server.run_server(), boost::asio::detached);
-    boost::asio::co_spawn(io_context, discovery_service.run_service(), boost::asio::detached);
+    // Each service runs on its own strand, so its coroutines don't need to synchronize with each other.
+    boost::asio::co_spawn(boost::asio::make_strand(main_context), discovery_service.run_service(), boost::asio::detached);
+    for (auto& shard : shards)
+    {
+        boost::asio::co_spawn(boost::asio::make_strand(shard.io_context), shard.server.run_server(), boost::asio::detached);
+        boost::asio::co_spawn(boost::asio::make_strand(shard.io_context), shard.content_service.run(), boost::asio::detached);
+    }
 
-    io_context.run();
+    spdlog::info("Running on {} threads, {} shards", threads, shard_count);
+    std::vector<std::jthread> workers;
+    workers.reserve(threads - 1);
+    for (std::size_t i = 1; i < threads; ++i)
+    {
+        workers.emplace_back([&io_context = shards[i / threads_per_shard].io_context]
+                             { io_context.run(); });
+    }
+    main_context.run();
 
     return 0;
 }
@@ -0,0 +1,173 @@
+#include "open_file_cache.h"
+
+#include <array>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fmt/std.h>
+#include <spdlog/spdlog.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace eems
+{
+
+namespace
+{
+// Anything that can make the cached size, mtime or descriptor stale.
+constexpr std::uint32_t watched_events = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF;
+}
+
+open_file_cache::open_file_cache(std::chrono::seconds idle_timeout)
+    : idle_timeout_{idle_timeout},
+      inotify_fd_{::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)}
+{
+    if (inotify_fd_ < 0)
+    {
+        spdlog::warn("Can't watch open files: {}, they will be cached only while in use", std::strerror(errno));
+    }
+}
+
+open_file_cache::~open_file_cache()
+{
+    if (inotify_fd_ >= 0)
+    {
+        ::close(inotify_fd_);
+    }
+}
+
+auto open_file_cache::get(ResourceKey id) -> entry_ptr
+{
+    std::lock_guard lock{mutex_};
+    auto it = entries_.find(id.id());
+    if (it == entries_.end())
+    {
+        return nullptr;
+    }
+    it->second.last_used = std::chrono::steady_clock::now();
+    return it->second.file;
+}
+
+auto open_file_cache::put(ResourceKey id, entry_ptr file) -> void
+{
+    std::lock_guard lock{mutex_};
+    if (auto it = entries_.find(id.id()); it != entries_.end())
+    {
+        erase(it);
+    }
+
+    // Without a watch changes would go unnoticed, so the file is not cached.
+    auto const watch = inotify_fd_ < 0 ? -1 : ::inotify_add_watch(inotify_fd_, file->location.c_str(), watched_events);
+    if (watch < 0)
+    {
+        return;
+    }
+    watches_.emplace(watch, id.id());
+    entries_.emplace(id.id(), slot{std::move(file), std::chrono::steady_clock::now(), watch});
+}
+
+auto open_file_cache::invalidate(ResourceKey id) -> void
+{
+    std::lock_guard lock{mutex_};
+    if (auto it = entries_.find(id.id()); it != entries_.end())
+    {
+        erase(it);
+    }
+}
+
+auto open_file_cache::erase(std::unordered_map<int64_t, slot>::iterator it) -> void
+{
+    auto const watch = it->second.watch;
+    auto const id = it->first;
+    entries_.erase(it);
+
+    auto [first, last] = watches_.equal_range(watch);
+    for (auto w = first; w != last; ++w)
+    {
+        if (w->second == id)
+        {
+            watches_.erase(w);
+            break;
+        }
+    }
+    if (!watches_.contains(watch))
+    {
+        ::inotify_rm_watch(inotify_fd_, watch);
+    }
+}
+
+auto open_file_cache::run() -> net::awaitable<void>
+{
+    using namespace net::experimental::awaitable_operators;
+    co_await (close_idle() && watch_changes());
+}
+
+auto open_file_cache::close_idle() -> net::awaitable<void>
+{
+    net::steady_timer timer{co_await net::this_coro::executor};
+    while (true)
+    {
+        timer.expires_after(idle_timeout_ / 2);
+        co_await timer.async_wait(net::use_awaitable);
+
+        auto const oldest = std::chrono::steady_clock::now() - idle_timeout_;
+        std::lock_guard lock{mutex_};
+        for (auto it = entries_.begin(); it != entries_.end();)
+        {
+            auto const current = it++;
+            // Files which are being streamed stay.
+            if (current->second.last_used < oldest && current->second.file.use_count() == 1)
+            {
+                spdlog::debug("Closing idle {}", current->second.file->location);
+                erase(current);
+            }
+        }
+    }
+}
+
+auto open_file_cache::watch_changes() -> net::awaitable<void>
+{
+    if (inotify_fd_ < 0)
+    {
+        co_return;
+    }
+
+    // Owns a duplicate, so the descriptor stays valid for add/rm_watch.
+    net::posix::stream_descriptor inotify{co_await net::this_coro::executor, ::dup(inotify_fd_)};
+    alignas(inotify_event) std::array<char, 4096> buffer;
+    while (true)
+    {
+        auto const size = co_await inotify.async_read_some(net::buffer(buffer), net::use_awaitable);
+        for (std::size_t pos = 0; pos < size;)
+        {
+            auto const* event = reinterpret_cast<inotify_event const*>(buffer.data() + pos);
+            pos += sizeof(inotify_event) + event->len;
+            // Sent for removed watches, whose descriptors may be already reused.
+            if (event->mask & IN_IGNORED)
+            {
+                continue;
+            }
+
+            std::vector<int64_t> changed;
+            {
+                std::lock_guard lock{mutex_};
+                auto [first, last] = watches_.equal_range(event->wd);
+                for (auto w = first; w != last; ++w)
+                {
+                    changed.push_back(w->second);
+                }
+            }
+            for (auto id : changed)
+            {
+                spdlog::debug("Resource {} changed", id);
+                invalidate(id);
+            }
+        }
+    }
+}
+
+}
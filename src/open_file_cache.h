@@ -0,0 +1,74 @@
+#ifndef EEMS_OPEN_FILE_CACHE_H
+#define EEMS_OPEN_FILE_CACHE_H
+
+#include "file_validators.h"
+#include "fs.h"
+#include "net.h"
+#include "store/schema_generated.h"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/beast/core/file.hpp>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace eems
+{
+
+// Keeps served files open along with what's needed to serve them, so the
+// range requests renderers issue in bursts don't touch the store or the file system.
+// Entries are closed after being idle for a while and dropped when their file changes.
+// Safe to use from several threads.
+class open_file_cache
+{
+public:
+    struct entry
+    {
+        // Only positional reads are done, so the file is shared by concurrent requests.
+        beast::file file;
+        fs::path location;
+        std::string mime_type;
+        std::string dlna_features;
+        // Of the media, 0 when unknown.
+        std::chrono::milliseconds duration{0};
+        file_validators validators;
+    };
+    // Requests keep their entry (and the descriptor) alive even when it's dropped from the cache.
+    using entry_ptr = std::shared_ptr<entry>;
+
+    explicit open_file_cache(std::chrono::seconds idle_timeout = std::chrono::seconds(60));
+    ~open_file_cache();
+
+    auto get(ResourceKey id) -> entry_ptr;
+    auto put(ResourceKey id, entry_ptr file) -> void;
+    auto invalidate(ResourceKey id) -> void;
+
+    // Closes idle files and watches for changes, runs until the executor is stopped.
+    auto run() -> net::awaitable<void>;
+
+private:
+    struct slot
+    {
+        entry_ptr file;
+        std::chrono::steady_clock::time_point last_used;
+        int watch{-1};
+    };
+
+    // Called with the mutex locked.
+    auto erase(std::unordered_map<int64_t, slot>::iterator it) -> void;
+    auto close_idle() -> net::awaitable<void>;
+    auto watch_changes() -> net::awaitable<void>;
+
+private:
+    std::chrono::seconds idle_timeout_;
+    std::mutex mutex_;
+    std::unordered_map<int64_t, slot> entries_;
+    // The same file may be served as several resources.
+    std::unordered_multimap<int, int64_t> watches_;
+    int inotify_fd_{-1};
+};
+
+}
+
+#endif
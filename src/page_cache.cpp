@@ -0,0 +1,93 @@
+#include "page_cache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <memory>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace eems
+{
+
+namespace
+{
+// Avoids a syscall for every small chunk.
+constexpr std::uint64_t drop_batch{2 * 1024 * 1024};
+
+auto page_size() -> std::uint64_t
+{
+    static auto const size = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+    return size;
+}
+}
+
+read_advisor::read_advisor(int fd, page_cache_config const* config, std::uint64_t offset)
+    : fd_{fd},
+      config_{config},
+      advised_until_{offset},
+      dropped_until_{offset}
+{
+    if (!config_)
+        return;
+
+    // Also doubles the kernel's own read-ahead window.
+    ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    advance(offset);
+}
+
+auto read_advisor::advance(std::uint64_t position) -> void
+{
+    if (!config_)
+        return;
+
+    // Renewed when half of the window was consumed.
+    if (config_->read_ahead && position + config_->read_ahead / 2 >= advised_until_)
+    {
+        auto const until = position + config_->read_ahead;
+        ::posix_fadvise(fd_, static_cast<off_t>(advised_until_), static_cast<off_t>(until - advised_until_), POSIX_FADV_WILLNEED);
+        advised_until_ = until;
+    }
+    if (config_->drop_behind && position >= dropped_until_ + drop_batch)
+    {
+        ::posix_fadvise(fd_, static_cast<off_t>(dropped_until_), static_cast<off_t>(position - dropped_until_), POSIX_FADV_DONTNEED);
+        dropped_until_ = position;
+    }
+}
+
+auto is_cached(int fd, std::uint64_t offset, std::size_t size) -> bool
+{
+    // Mapping the file doesn't read it, it only tells which of its pages are in the cache.
+    auto const begin = offset / page_size() * page_size();
+    auto const length = static_cast<std::size_t>(offset + size - begin);
+    auto* const data = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(begin));
+    if (data == MAP_FAILED)
+        return false;
+
+    thread_local std::vector<unsigned char> pages;
+    pages.resize((length + page_size() - 1) / page_size());
+    auto const rc = ::mincore(data, length, pages.data());
+    ::munmap(data, length);
+    return rc == 0 && std::ranges::all_of(pages, [](unsigned char page) { return page & 1; });
+}
+
+auto load_into_cache(int fd, std::uint64_t offset, std::size_t size) -> void
+{
+    // Read into a scratch buffer rather than touching a mapping, which would crash on a truncated file.
+    constexpr std::size_t scratch_size{256 * 1024};
+    thread_local auto const scratch = std::make_unique<char[]>(scratch_size);
+    while (size)
+    {
+        auto const read = ::pread(fd, scratch.get(), std::min(size, scratch_size), static_cast<off_t>(offset));
+        if (read < 0 && errno == EINTR)
+            continue;
+        // Errors are left to the send.
+        if (read <= 0)
+            return;
+        offset += read;
+        size -= read;
+    }
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef EEMS_PAGE_CACHE_H
+#define EEMS_PAGE_CACHE_H
+
+#include "data_config.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace eems
+{
+
+// Applies a page cache policy to a file which is read sequentially:
+// asks the kernel to read ahead of the position and to drop what's behind it.
+// Does nothing without a policy.
+class read_advisor
+{
+public:
+    read_advisor(int fd, page_cache_config const* config, std::uint64_t offset);
+
+    // Data up to the position was read.
+    auto advance(std::uint64_t position) -> void;
+
+private:
+    int fd_;
+    page_cache_config const* config_;
+    std::uint64_t advised_until_;
+    std::uint64_t dropped_until_;
+};
+
+// Whether the whole range of the file is in the page cache, so reading (or sending) it won't wait for the drive.
+auto is_cached(int fd, std::uint64_t offset, std::size_t size) -> bool;
+
+// Reads the range of the file into the page cache. Blocks until it's there, so it's meant for a pool.
+auto load_into_cache(int fd, std::uint64_t offset, std::size_t size) -> void;
+
+}
+
+#endif
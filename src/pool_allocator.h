@@ -0,0 +1,62 @@
+#ifndef EEMS_POOL_ALLOCATOR_H
+#define EEMS_POOL_ALLOCATOR_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <type_traits>
+
+namespace eems
+{
+
+// Allocates from a memory resource, e.g. a per-connection pool. Unlike std::pmr::polymorphic_allocator
+// it's assignable, which Beast requires from the allocator of fields.
+template <typename T>
+class pool_allocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    pool_allocator() noexcept = default;
+
+    explicit pool_allocator(std::pmr::memory_resource* resource) noexcept
+        : resource_{resource}
+    {
+    }
+
+    template <typename U>
+    pool_allocator(pool_allocator<U> const& other) noexcept
+        : resource_{other.resource()}
+    {
+    }
+
+    auto allocate(std::size_t n) -> T*
+    {
+        return static_cast<T*>(resource_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    auto deallocate(T* p, std::size_t n) -> void
+    {
+        resource_->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    auto resource() const noexcept -> std::pmr::memory_resource*
+    {
+        return resource_;
+    }
+
+    template <typename U>
+    auto operator==(pool_allocator<U> const& other) const noexcept -> bool
+    {
+        return resource_ == other.resource();
+    }
+
+private:
+    std::pmr::memory_resource* resource_{std::pmr::get_default_resource()};
+};
+
+}
+
+#endif
@@ -0,0 +1,268 @@
+#include "prefix_cache.h"
+
+#include "fnv_hash.h"
+
+#include <fmt/std.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace eems
+{
+
+namespace
+{
+struct entry_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t file_size;
+    uint64_t inode;
+    int64_t mtime;
+    uint64_t head_size;
+    uint64_t tail_size;
+    // Followed by the location of the file, the cached data comes after it.
+    uint64_t location_size;
+};
+
+constexpr uint32_t entry_magic = 0x434d4545; // EEMC
+constexpr uint32_t entry_version = 3;
+constexpr uint64_t max_location_size = 64 * 1024;
+
+// Tells apart the entries being written by this process.
+std::atomic<std::uint64_t> temp_counter{0};
+
+auto copy_range(beast::file& in, beast::file& out, std::uintmax_t size, beast::error_code& ec) -> void
+{
+    std::vector<char> buffer(std::min<std::uintmax_t>(size, 1024 * 1024));
+    while (size && !ec)
+    {
+        auto const read_bytes = in.read(buffer.data(), std::min<std::uintmax_t>(size, buffer.size()), ec);
+        if (ec)
+            return;
+        if (!read_bytes)
+        {
+            ec = beast::errc::make_error_code(beast::errc::io_error);
+            return;
+        }
+        out.write(buffer.data(), read_bytes, ec);
+        size -= read_bytes;
+    }
+}
+}
+
+auto prefix_cache::entry::cache_offset(std::uintmax_t offset) const -> std::uintmax_t
+{
+    return in_head(offset) ? data_offset_ + offset
+                           : data_offset_ + head_size_ + (offset - tail_offset());
+}
+
+auto prefix_cache::entry_path(fs::path const& location) const -> fs::path
+{
+    return config_.path / fmt::format("{:016x}.prefix", fnv_hash(location.c_str(), location.native().size()));
+}
+
+auto prefix_cache::open(fs::path const& location) const -> std::optional<entry>
+{
+    if (!enabled())
+    {
+        return std::nullopt;
+    }
+
+    entry result{};
+    beast::error_code ec;
+    auto const path = entry_path(location);
+    result.file.open(path.c_str(), beast::file_mode::read, ec);
+    if (ec)
+    {
+        return std::nullopt;
+    }
+
+    entry_header header{};
+    if (result.file.read(&header, sizeof(header), ec) != sizeof(header) || ec ||
+        header.magic != entry_magic || header.version != entry_version ||
+        header.head_size + header.tail_size > header.file_size || header.location_size > max_location_size)
+    {
+        spdlog::warn("Ignoring invalid cache entry {}", path);
+        return std::nullopt;
+    }
+
+    // The name only tells which file the entry is likely of.
+    auto stored_location = fs::path::string_type(header.location_size, '\0');
+    if (result.file.read(stored_location.data(), stored_location.size(), ec) != stored_location.size() || ec ||
+        stored_location != location.native())
+    {
+        spdlog::debug("Cache entry {} isn't of {}", path, location);
+        return std::nullopt;
+    }
+
+    // The modification time of the entry tells when it was played last.
+    if (::futimens(result.file.native_handle(), nullptr) < 0)
+    {
+        spdlog::debug("Can't touch cache entry {}: {}", path, std::strerror(errno));
+    }
+
+    result.validators_ = {.inode = header.inode, .size = header.file_size, .mtime = header.mtime};
+    result.data_offset_ = sizeof(header) + header.location_size;
+    result.head_size_ = header.head_size;
+    result.tail_size_ = header.tail_size;
+    return result;
+}
+
+auto prefix_cache::populate(fs::path const& source) -> void
+{
+    {
+        std::lock_guard lock{mutex_};
+        if (!populating_.insert(source.native()).second)
+            return;
+    }
+
+    // Another process may write the same entry, so the name is unique and the file is never opened twice.
+    auto const final_path = entry_path(source);
+    auto temp_path = final_path;
+    temp_path += fmt::format(".{}.{}.tmp", ::getpid(), temp_counter.fetch_add(1, std::memory_order_relaxed));
+
+    beast::error_code ec;
+    [&]()
+    {
+        beast::file in;
+        in.open(source.c_str(), beast::file_mode::scan, ec);
+        if (ec)
+            return;
+        // Validators of the original are kept, so conditional requests are answered without touching it.
+        struct stat st;
+        if (::fstat(in.native_handle(), &st) < 0)
+        {
+            ec = {errno, boost::system::system_category()};
+            return;
+        }
+        std::uintmax_t const file_size = st.st_size;
+
+        auto const head_size = std::min<std::uintmax_t>(file_size, config_.head_size);
+        entry_header const header{
+            .magic = entry_magic,
+            .version = entry_version,
+            .file_size = file_size,
+            .inode = st.st_ino,
+            .mtime = st.st_mtim.tv_sec * std::int64_t{1'000'000'000} + st.st_mtim.tv_nsec,
+            .head_size = head_size,
+            .tail_size = std::min<std::uintmax_t>(file_size - head_size, config_.tail_size),
+            .location_size = source.native().size(),
+        };
+
+        auto const fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            ec = {errno, boost::system::system_category()};
+            return;
+        }
+        beast::file out;
+        out.native_handle(fd);
+        out.write(&header, sizeof(header), ec);
+        if (ec)
+            return;
+        out.write(source.c_str(), header.location_size, ec);
+        if (ec)
+            return;
+        copy_range(in, out, header.head_size, ec);
+        if (ec)
+            return;
+        in.seek(file_size - header.tail_size, ec);
+        if (ec)
+            return;
+        copy_range(in, out, header.tail_size, ec);
+        if (ec)
+            return;
+        out.close(ec);
+    }();
+
+    // Publish complete entries only.
+    std::error_code fs_ec;
+    if (!ec)
+    {
+        fs::rename(temp_path, final_path, fs_ec);
+    }
+
+    if (ec || fs_ec)
+    {
+        spdlog::warn("Failed to cache {}: {}", source, ec ? ec.message() : fs_ec.message());
+        fs::remove(temp_path, fs_ec);
+    }
+    else
+    {
+        spdlog::debug("Cached beginning of {} as {}", source, final_path);
+        evict();
+    }
+
+    std::lock_guard lock{mutex_};
+    populating_.erase(source.native());
+}
+
+auto prefix_cache::invalidate(fs::path const& location) -> void
+{
+    spdlog::info("Removing stale cache entry for {}", location);
+    std::error_code ec;
+    fs::remove(entry_path(location), ec);
+}
+
+auto prefix_cache::evict() -> void
+{
+    if (!config_.max_size)
+        return;
+    // Entries are populated in parallel, each of them would remove entries for the same excess.
+    std::lock_guard lock{evict_mutex_};
+
+    struct cached_file
+    {
+        fs::path path;
+        std::uintmax_t size;
+        fs::file_time_type last_used;
+    };
+    std::vector<cached_file> files;
+    std::uintmax_t total_size = 0;
+
+    std::error_code ec;
+    for (auto it = fs::directory_iterator{config_.path, ec}; !ec && it != fs::directory_iterator{}; it.increment(ec))
+    {
+        // Other files, like the artwork directory or entries being written, aren't counted.
+        std::error_code file_ec;
+        if (it->path().extension() != ".prefix" || !it->is_regular_file(file_ec))
+            continue;
+        auto const size = it->file_size(file_ec);
+        auto const last_used = it->last_write_time(file_ec);
+        if (file_ec)
+            continue;
+        total_size += size;
+        files.push_back({.path = it->path(), .size = size, .last_used = last_used});
+    }
+    if (ec)
+    {
+        spdlog::warn("Can't list cache {}: {}", config_.path, ec.message());
+        return;
+    }
+    if (total_size <= config_.max_size)
+        return;
+
+    std::ranges::sort(files, {}, &cached_file::last_used);
+    for (auto const& file : files)
+    {
+        if (total_size <= config_.max_size)
+            break;
+        // Entries being sent stay readable until they're closed.
+        if (fs::remove(file.path, ec))
+        {
+            spdlog::debug("Evicted cache entry {}", file.path);
+            total_size -= file.size;
+        }
+    }
+}
+
+}
@@ -0,0 +1,93 @@
+#ifndef EEMS_PREFIX_CACHE_H
+#define EEMS_PREFIX_CACHE_H
+
+#include "cache_config.h"
+#include "file_validators.h"
+#include "fs.h"
+#include "net.h"
+
+#include <algorithm>
+#include <boost/beast/core/file.hpp>
+#include <mutex>
+#include <optional>
+#include <unordered_set>
+
+namespace eems
+{
+
+// Keeps the beginning and the end of media files on a fast drive,
+// so playback can start while the drive with the media is spinning up.
+// Entries are named after the location of the file, which they also keep, so an entry
+// never belongs to another file, and the least recently played are removed when it's full.
+class prefix_cache
+{
+public:
+    explicit prefix_cache(cache_config const& config)
+        : config_{config}
+    {
+    }
+
+    class entry
+    {
+    public:
+        // Size of the original file.
+        auto file_size() const { return validators_.size; }
+        // Of the original file when it was cached.
+        auto validators() const -> file_validators const& { return validators_; }
+        auto head_size() const { return head_size_; }
+        auto tail_offset() const { return validators_.size - tail_size_; }
+
+        auto in_head(std::uintmax_t offset) const -> bool { return offset < head_size_; }
+        auto in_tail(std::uintmax_t offset) const -> bool { return offset >= tail_offset() && offset < validators_.size; }
+
+        // How much of the range can be read from the cache.
+        auto cached_size(std::uintmax_t offset, std::uintmax_t size) const -> std::uintmax_t
+        {
+            return in_head(offset)   ? std::min(size, head_size_ - offset)
+                   : in_tail(offset) ? size
+                                     : 0;
+        }
+
+        // Offset in the cache file of the given offset of the original file,
+        // which must be either in the head or in the tail.
+        auto cache_offset(std::uintmax_t offset) const -> std::uintmax_t;
+
+        beast::file file;
+
+    private:
+        friend class prefix_cache;
+
+        file_validators validators_;
+        // Where the cached data starts, after the header and the location.
+        std::uintmax_t data_offset_{0};
+        std::uintmax_t head_size_{0};
+        std::uintmax_t tail_size_{0};
+    };
+
+    auto enabled() const -> bool { return !config_.path.empty(); }
+
+    auto open(fs::path const& location) const -> std::optional<entry>;
+
+    // Copies head and tail of the file into the cache. Blocks on I/O, so
+    // it's meant to be run in the background. Safe to call from several threads, all shards share a cache.
+    auto populate(fs::path const& source) -> void;
+
+    // Drops the entry when it doesn't match the original file anymore.
+    auto invalidate(fs::path const& location) -> void;
+
+private:
+    auto entry_path(fs::path const& location) const -> fs::path;
+
+    // Removes the least recently used entries until the cache fits into its size.
+    auto evict() -> void;
+
+private:
+    cache_config const& config_;
+    std::mutex mutex_;
+    std::unordered_set<fs::path::string_type> populating_;
+    std::mutex evict_mutex_;
+};
+
+}
+
+#endif
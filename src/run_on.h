@@ -0,0 +1,28 @@
+#ifndef EEMS_RUN_ON_H
+#define EEMS_RUN_ON_H
+
+#include "net.h"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <type_traits>
+
+namespace eems
+{
+
+// Runs a blocking function on the pool and resumes on the caller's executor.
+template <typename F>
+auto run_on(net::thread_pool& pool, F func) -> net::awaitable<std::invoke_result_t<F&>>
+{
+    co_return co_await net::co_spawn(
+        pool,
+        [func = std::move(func)]() mutable -> net::awaitable<std::invoke_result_t<F&>>
+        { co_return func(); },
+        net::use_awaitable);
+}
+
+}
+
+#endif
@@ -0,0 +1,296 @@
+#include "artwork_scaler.h"
+
+#include "../fnv_hash.h"
+
+#include <algorithm>
+#include <fmt/std.h>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
+#include <spdlog/spdlog.h>
+#include <turbojpeg.h>
+
+namespace eems
+{
+
+namespace
+{
+struct profile_limits
+{
+    ArtworkProfile profile;
+    int width;
+    int height;
+};
+
+// Maximum resolutions of the DLNA JPEG profiles.
+constexpr profile_limits profiles[] = {
+    {ArtworkProfile::JPEG_TN, 160, 160},
+    {ArtworkProfile::JPEG_SM, 640, 480},
+    {ArtworkProfile::JPEG_MED, 1024, 768},
+};
+
+constexpr auto jpeg_quality = 85;
+constexpr auto pixel_size = 3; // TJPF_RGB
+
+struct tj_deleter
+{
+    auto operator()(void* handle) const { tjDestroy(handle); }
+};
+using tj_handle = std::unique_ptr<void, tj_deleter>;
+
+struct tj_buffer_deleter
+{
+    auto operator()(unsigned char* buffer) const { tjFree(buffer); }
+};
+
+struct image
+{
+    int width{0};
+    int height{0};
+    std::vector<unsigned char> pixels;
+};
+
+// Largest size with the same aspect ratio which fits into the limits.
+inline auto fit(int width, int height, profile_limits const& limits) -> std::pair<int, int>
+{
+    auto const scale = std::min(static_cast<double>(limits.width) / width,
+                                static_cast<double>(limits.height) / height);
+    return {std::max(1, static_cast<int>(width * scale)), std::max(1, static_cast<int>(height * scale))};
+}
+
+auto read_file(fs::path const& path) -> std::vector<unsigned char>
+{
+    std::ifstream file{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+// Decodes the image using DCT scaling, to the smallest size which is still at least width x height.
+// This is much cheaper than decoding the full image, a 1/8 scale skips most of the IDCT.
+auto decode(tjhandle handle, std::vector<unsigned char> const& jpeg, std::pair<int, int> full_size,
+            int width, int height, image& result)
+    -> bool
+{
+    auto const [full_width, full_height] = full_size;
+    int count = 0;
+    auto const* factors = tjGetScalingFactors(&count);
+    result.width = full_width;
+    result.height = full_height;
+    for (auto const& factor : std::span{factors, static_cast<std::size_t>(count)})
+    {
+        auto const scaled_width = TJSCALED(full_width, factor);
+        auto const scaled_height = TJSCALED(full_height, factor);
+        if (scaled_width >= width && scaled_height >= height && scaled_width < result.width)
+        {
+            result.width = scaled_width;
+            result.height = scaled_height;
+        }
+    }
+
+    result.pixels.resize(static_cast<std::size_t>(result.width) * result.height * pixel_size);
+    return tjDecompress2(handle, jpeg.data(), jpeg.size(), result.pixels.data(),
+                         result.width, 0, result.height, TJPF_RGB, TJFLAG_FASTDCT) == 0;
+}
+
+// Box filter, each target pixel is an average of the source pixels it covers.
+auto downscale(image const& source, int width, int height) -> image
+{
+    image result{width, height, std::vector<unsigned char>(static_cast<std::size_t>(width) * height * pixel_size)};
+    auto out = result.pixels.begin();
+    for (int y = 0; y < height; ++y)
+    {
+        auto const y0 = y * source.height / height;
+        auto const y1 = std::max(y0 + 1, (y + 1) * source.height / height);
+        for (int x = 0; x < width; ++x)
+        {
+            auto const x0 = x * source.width / width;
+            auto const x1 = std::max(x0 + 1, (x + 1) * source.width / width);
+            unsigned sum[pixel_size]{};
+            for (int sy = y0; sy < y1; ++sy)
+            {
+                auto in = source.pixels.begin() + (static_cast<std::size_t>(sy) * source.width + x0) * pixel_size;
+                for (int sx = x0; sx < x1; ++sx)
+                {
+                    for (auto& channel : sum)
+                        channel += *in++;
+                }
+            }
+            auto const area = static_cast<unsigned>((y1 - y0) * (x1 - x0));
+            for (auto channel : sum)
+                *out++ = static_cast<unsigned char>(channel / area);
+        }
+    }
+    return result;
+}
+
+auto encode(tjhandle handle, image const& source, fs::path const& path) -> bool
+{
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;
+    auto const rc = tjCompress2(handle, source.pixels.data(), source.width, 0, source.height, TJPF_RGB,
+                                &buffer, &size, TJSAMP_420, jpeg_quality, TJFLAG_FASTDCT);
+    std::unique_ptr<unsigned char, tj_buffer_deleter> const guard{buffer};
+    if (rc != 0)
+        return false;
+
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<char const*>(buffer), static_cast<std::streamsize>(size));
+    return static_cast<bool>(file);
+}
+
+// Records which image the variants are of, once they're all written.
+constexpr auto source_extension = ".source";
+
+inline auto variant_path(fs::path const& prefix, ArtworkProfile profile) -> fs::path
+{
+    auto path = prefix;
+    path += fmt::format("_{}.jpg", EnumNameArtworkProfile(profile));
+    return path;
+}
+
+// Name of the variants of the image as it's now.
+auto variant_prefix(fs::path const& source, fs::path const& cache, std::error_code& ec) -> fs::path
+{
+    auto const mtime = fs::last_write_time(source, ec).time_since_epoch().count();
+    if (ec)
+        return {};
+    auto const size = fs::file_size(source, ec);
+    if (ec)
+        return {};
+    auto hash = fnv_hash(source.c_str(), source.native().size());
+    hash = fnv_hash(&mtime, sizeof(mtime), hash);
+    hash = fnv_hash(&size, sizeof(size), hash);
+    return cache / fmt::format("{:016x}", hash);
+}
+
+// Writes the variants named after the prefix with the profile appended, e.g. "<prefix>_JPEG_TN.jpg".
+// Returns none when the image can't be decoded, which won't change until the image does,
+// but nothing at all when a variant can't be written.
+auto scale_artwork(fs::path const& source, fs::path const& output_prefix)
+    -> std::optional<std::vector<artwork_variant>>
+{
+    std::vector<artwork_variant> result;
+
+    auto const jpeg = read_file(source);
+    tj_handle const decompressor{tjInitDecompress()};
+    int width = 0;
+    int height = 0;
+    int subsampling = 0;
+    int colorspace = 0;
+    if (jpeg.empty() ||
+        tjDecompressHeader3(decompressor.get(), jpeg.data(), jpeg.size(), &width, &height, &subsampling, &colorspace) != 0)
+    {
+        spdlog::warn("Can't read artwork {}: {}", source, tjGetErrorStr2(decompressor.get()));
+        return result;
+    }
+
+    // Profiles are ordered by size, the image is decoded once for the biggest one it needs.
+    auto const needed = std::ranges::find_if(profiles, [width, height](profile_limits const& limits)
+                                             { return width <= limits.width && height <= limits.height; }) -
+                        std::begin(profiles);
+    if (needed == 0)
+        return result;
+
+    auto const [decode_width, decode_height] = fit(width, height, profiles[needed - 1]);
+    image decoded;
+    if (!decode(decompressor.get(), jpeg, {width, height}, decode_width, decode_height, decoded))
+    {
+        spdlog::warn("Can't decode artwork {}: {}", source, tjGetErrorStr2(decompressor.get()));
+        return result;
+    }
+
+    tj_handle const compressor{tjInitCompress()};
+    for (auto const& limits : std::span{profiles, static_cast<std::size_t>(needed)})
+    {
+        auto const [scaled_width, scaled_height] = fit(width, height, limits);
+        auto path = variant_path(output_prefix, limits.profile);
+        if (!encode(compressor.get(), downscale(decoded, scaled_width, scaled_height), path))
+        {
+            spdlog::warn("Can't write artwork {}: {}", path, tjGetErrorStr2(compressor.get()));
+            return std::nullopt;
+        }
+        spdlog::debug("Scaled artwork {} to {}x{}", source, scaled_width, scaled_height);
+        result.push_back({limits.profile, std::move(path)});
+    }
+    return result;
+}
+
+}
+
+auto get_scaled_artwork(fs::path const& source, fs::path const& cache)
+    -> std::vector<artwork_variant>
+{
+    std::error_code ec;
+    auto const prefix = variant_prefix(source, cache, ec);
+    if (ec)
+    {
+        spdlog::warn("Can't read artwork {}: {}", source, ec.message());
+        return {};
+    }
+    auto marker = prefix;
+    marker += source_extension;
+
+    if (fs::exists(marker, ec))
+    {
+        std::vector<artwork_variant> result;
+        for (auto const& limits : profiles)
+        {
+            if (auto path = variant_path(prefix, limits.profile); fs::exists(path, ec))
+                result.push_back({limits.profile, std::move(path)});
+        }
+        spdlog::debug("Reusing scaled artwork of {}", source);
+        return result;
+    }
+
+    auto result = scale_artwork(source, prefix);
+    if (!result)
+        return {};
+    if (!(std::ofstream{marker, std::ios::binary | std::ios::trunc} << source.native()))
+        spdlog::warn("Can't write artwork {}, it will be scaled again", marker);
+    return std::move(*result);
+}
+
+auto remove_stale_artwork(fs::path const& cache, fs::path const& root)
+    -> void
+{
+    // A library which isn't mounted keeps its artwork.
+    std::error_code ec;
+    if (cache.empty() || !fs::is_directory(root, ec))
+        return;
+
+    std::size_t removed = 0;
+    for (auto it = fs::directory_iterator{cache, ec}; !ec && it != fs::directory_iterator{}; it.increment(ec))
+    {
+        if (it->path().extension() != source_extension)
+            continue;
+
+        auto const contents = read_file(it->path());
+        auto const source = fs::path{std::string{contents.begin(), contents.end()}};
+        // Images of other libraries are checked when those are scanned.
+        if (auto const relative = source.lexically_relative(root); relative.empty() || *relative.begin() == "..")
+            continue;
+
+        auto prefix = it->path();
+        prefix.replace_extension();
+        std::error_code source_ec;
+        if (variant_prefix(source, cache, source_ec) == prefix)
+            continue;
+
+        std::error_code remove_ec;
+        for (auto const& limits : profiles)
+            fs::remove(variant_path(prefix, limits.profile), remove_ec);
+        fs::remove(it->path(), remove_ec);
+        ++removed;
+    }
+    if (ec)
+    {
+        spdlog::warn("Can't list artwork cache {}: {}", cache, ec.message());
+    }
+    if (removed)
+    {
+        spdlog::info("Removed scaled artwork of {} removed or changed images", removed);
+    }
+}
+
+}
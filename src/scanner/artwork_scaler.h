@@ -0,0 +1,31 @@
+#ifndef EEMS_ARTWORK_SCALER_H
+#define EEMS_ARTWORK_SCALER_H
+
+#include "../fs.h"
+#include "../store/schema_generated.h"
+
+#include <vector>
+
+namespace eems
+{
+
+struct artwork_variant
+{
+    ArtworkProfile profile;
+    fs::path path;
+};
+
+// Downscaled copies of a JPEG image in each standard size it's bigger than, kept in the cache directory.
+// They're named after the location of the image and its modification time, so later scans reuse them
+// and the image is only scaled again when it changes.
+// Returns the variants from the smallest one, nothing if the image can't be decoded.
+auto get_scaled_artwork(fs::path const& source, fs::path const& cache)
+    -> std::vector<artwork_variant>;
+
+// Removes the variants of images under the root which were removed or changed since they were scaled.
+auto remove_stale_artwork(fs::path const& cache, fs::path const& root)
+    -> void;
+
+}
+
+#endif
@@ -0,0 +1,247 @@
+#include "dlna_profile.h"
+
+#include "media_reader.h"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <fmt/std.h>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+namespace eems
+{
+
+namespace
+{
+// DLNA.ORG_FLAGS, only the first 8 of 32 hex digits are used.
+constexpr std::uint32_t streaming_transfer_mode = 1 << 24;
+constexpr std::uint32_t interactive_transfer_mode = 1 << 23;
+constexpr std::uint32_t background_transfer_mode = 1 << 22;
+constexpr std::uint32_t connection_stall = 1 << 21;
+constexpr std::uint32_t dlna_v15 = 1 << 20;
+
+// A sequence header is expected within the first few packs.
+constexpr std::size_t mpeg_probe_size = 256 * 1024;
+
+// The first sample entry follows the entry count in stsd, a visual one has its boxes after 78 bytes of fields.
+constexpr std::size_t sample_entry_offset = 8;
+constexpr std::size_t visual_entry_boxes = sample_entry_offset + 86;
+
+// AVCProfileIndication, constraint_set1_flag marks Baseline streams which Main decoders can play.
+constexpr std::uint8_t avc_baseline = 66;
+constexpr std::uint8_t avc_main = 77;
+constexpr std::uint8_t avc_high = 100;
+constexpr std::uint8_t avc_constraint_set1 = 0x40;
+
+struct mp4_tracks
+{
+    std::uint32_t video{0};
+    std::uint16_t width{0};
+    std::uint16_t height{0};
+    // From avcC, 0 for other codecs.
+    std::uint8_t avc_profile{0};
+    std::uint8_t avc_compatibility{0};
+    std::uint8_t avc_level{0};
+    std::uint32_t audio{0};
+};
+
+// Finds avcC among the boxes of the visual sample entry.
+auto read_avc_config(mp4::table const& stsd, mp4_tracks& tracks) -> void
+{
+    auto const entry_end = sample_entry_offset + stsd.u32(sample_entry_offset);
+    for (std::size_t position = visual_entry_boxes; position + 8 <= entry_end && stsd.has(position, 8);)
+    {
+        auto const size = stsd.u32(position);
+        if (size < 8)
+            return;
+        if (stsd.u32(position + 4) == mp4::fourcc("avcC"))
+        {
+            // After configurationVersion.
+            tracks.avc_profile = stsd.u8(position + 9);
+            tracks.avc_compatibility = stsd.u8(position + 10);
+            tracks.avc_level = stsd.u8(position + 11);
+            return;
+        }
+        position += size;
+    }
+}
+
+// Sample entry types of the first video and audio tracks.
+auto read_mp4_tracks(std::istream& in, std::uint64_t file_size) -> mp4_tracks
+{
+    mp4_tracks result{};
+    auto const moov = mp4::find_child(in, mp4::box{0, 0, file_size}, mp4::fourcc("moov"));
+    if (!moov)
+        return result;
+
+    for (auto position = moov->data_offset; position < moov->end();)
+    {
+        auto const trak = mp4::read_box(in, position, moov->end());
+        if (!trak)
+            break;
+        position = trak->end();
+        auto const mdia = trak->type == mp4::fourcc("trak") ? mp4::find_child(in, *trak, mp4::fourcc("mdia")) : std::nullopt;
+        auto const minf = mdia ? mp4::find_child(in, *mdia, mp4::fourcc("minf")) : std::nullopt;
+        auto const stbl = minf ? mp4::find_child(in, *minf, mp4::fourcc("stbl")) : std::nullopt;
+        mp4::table hdlr, stsd;
+        if (!stbl || !hdlr.load(in, mp4::find_child(in, *mdia, mp4::fourcc("hdlr"))) ||
+            !stsd.load(in, mp4::find_child(in, *stbl, mp4::fourcc("stsd"))))
+        {
+            continue;
+        }
+
+        // The first sample entry follows the entry count, its fields follow the 8 byte SampleEntry header.
+        auto const handler = hdlr.u32(8);
+        if (handler == mp4::fourcc("vide") && !result.video)
+        {
+            result.video = stsd.u32(12);
+            result.width = stsd.u16(40);
+            result.height = stsd.u16(42);
+            read_avc_config(stsd, result);
+        }
+        else if (handler == mp4::fourcc("soun") && !result.audio)
+        {
+            result.audio = stsd.u32(12);
+        }
+    }
+    return result;
+}
+
+// A profile is only claimed for streams within its limits, a renderer trusting it might not play others.
+auto mp4_profile(std::istream& in, std::uint64_t file_size) -> std::string
+{
+    auto const tracks = read_mp4_tracks(in, file_size);
+    auto const is_sd = tracks.width <= 720 && tracks.height <= 576;
+    auto const is_hd = tracks.width <= 1920 && tracks.height <= 1080;
+    auto const is_aac = tracks.audio == mp4::fourcc("mp4a");
+    if (tracks.video == mp4::fourcc("avc1") || tracks.video == mp4::fourcc("avc3"))
+    {
+        auto const is_main = tracks.avc_profile == avc_main ||
+                             (tracks.avc_profile == avc_baseline && (tracks.avc_compatibility & avc_constraint_set1));
+        auto const is_high = is_main || tracks.avc_profile == avc_high;
+        // Main Profile up to level 3 for SD, High Profile up to level 4 for HD.
+        if (is_sd && is_main && tracks.avc_level && tracks.avc_level <= 30)
+        {
+            if (is_aac)
+                return "AVC_MP4_MP_SD_AAC_MULT5";
+            if (tracks.audio == mp4::fourcc("ac-3"))
+                return "AVC_MP4_MP_SD_AC3";
+        }
+        if (is_hd && is_high && tracks.avc_level && tracks.avc_level <= 40 && is_aac)
+            return "AVC_MP4_HP_HD_AAC";
+        return {};
+    }
+    else if (tracks.video == mp4::fourcc("mp4v") && is_aac && is_sd)
+    {
+        return "MPEG4_P2_MP4_ASP_AAC";
+    }
+    return {};
+}
+
+// PAL or NTSC, from the frame rate of the first sequence header.
+auto mpeg_ps_profile(std::istream& in) -> std::string
+{
+    std::vector<unsigned char> data(mpeg_probe_size);
+    in.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    data.resize(static_cast<std::size_t>(in.gcount()));
+
+    constexpr unsigned char sequence_header[] = {0x00, 0x00, 0x01, 0xB3};
+    auto const found = std::search(data.begin(), data.end(), std::begin(sequence_header), std::end(sequence_header));
+    if (data.end() - found < 8)
+        return {};
+    auto const header = found - data.begin();
+    auto const width = (data[header + 4] << 4) | (data[header + 5] >> 4);
+    auto const height = ((data[header + 5] & 0x0f) << 8) | data[header + 6];
+    if (width > 720 || height > 576)
+        return {};
+    switch (data[header + 7] & 0x0f)
+    {
+    case 3: // 25
+        return "MPEG_PS_PAL";
+    case 1: // 23.976
+    case 2: // 24
+    case 4: // 29.97
+    case 5: // 30
+        return "MPEG_PS_NTSC";
+    }
+    return {};
+}
+
+auto jpeg_profile(std::istream& in) -> std::string
+{
+    if (in.get() != 0xFF || in.get() != 0xD8)
+        return {};
+
+    for (;;)
+    {
+        // Markers may be preceded by any number of fill bytes.
+        auto marker = in.get();
+        if (marker != 0xFF)
+            return {};
+        while (marker == 0xFF)
+            marker = in.get();
+
+        auto const length = read_uint(in, 2);
+        if (marker == std::istream::traits_type::eof() || !length || *length < 2)
+            return {};
+        // SOFn, except DHT, JPG and DAC which share the range.
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+        {
+            in.ignore(1); // Precision
+            auto const height = read_uint(in, 2);
+            auto const width = read_uint(in, 2);
+            if (!height || !width)
+                return {};
+            if (*width <= 160 && *height <= 160)
+                return "JPEG_TN";
+            if (*width <= 640 && *height <= 480)
+                return "JPEG_SM";
+            if (*width <= 1024 && *height <= 768)
+                return "JPEG_MED";
+            if (*width <= 4096 && *height <= 4096)
+                return "JPEG_LRG";
+            return {};
+        }
+        in.ignore(static_cast<std::streamsize>(*length - 2));
+    }
+}
+}
+
+auto detect_dlna_profile(fs::path const& path, std::u8string_view mime_type)
+    -> std::string
+{
+    auto const is_mp4 = mime_type == u8"video/mp4";
+    auto const is_mpeg = mime_type == u8"video/mpeg";
+    auto const is_jpeg = mime_type == u8"image/jpeg";
+    if (!is_mp4 && !is_mpeg && !is_jpeg)
+        return {};
+
+    std::error_code ec;
+    auto const file_size = fs::file_size(path, ec);
+    std::ifstream in{path, std::ios::binary};
+    if (ec || !in)
+    {
+        spdlog::warn("Can't detect DLNA profile of {}", path);
+        return {};
+    }
+
+    auto result = is_mp4 ? mp4_profile(in, file_size) : is_mpeg ? mpeg_ps_profile(in)
+                                                                : jpeg_profile(in);
+    spdlog::debug("DLNA profile of {}: {}", path, result.empty() ? "none" : result);
+    return result;
+}
+
+auto make_dlna_features(std::string_view profile, std::u8string_view mime_type, bool time_seek)
+    -> std::string
+{
+    auto const is_media = mime_type.starts_with(u8"video/") || mime_type.starts_with(u8"audio/");
+    auto const flags = (is_media ? streaming_transfer_mode : interactive_transfer_mode) |
+                       background_transfer_mode | connection_stall | dlna_v15;
+    // Ranges are always supported, time seek only with an index.
+    return fmt::format("{}DLNA.ORG_OP={};DLNA.ORG_CI=0;DLNA.ORG_FLAGS={:08x}{:024}",
+                       profile.empty() ? std::string{} : fmt::format("DLNA.ORG_PN={};", profile),
+                       time_seek ? "11" : "01", flags, 0);
+}
+
+}
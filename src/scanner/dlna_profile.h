@@ -0,0 +1,24 @@
+#ifndef EEMS_DLNA_PROFILE_H
+#define EEMS_DLNA_PROFILE_H
+
+#include "../fs.h"
+
+#include <string>
+#include <string_view>
+
+namespace eems
+{
+
+// DLNA media format profile (DLNA.ORG_PN) of the file, detected from its headers.
+// Empty when it doesn't conform to any, e.g. Matroska, AVI, HEVC or H.264 beyond the profile and level limits.
+auto detect_dlna_profile(fs::path const& path, std::u8string_view mime_type)
+    -> std::string;
+
+// Fourth field of protocolInfo, which is also sent as contentFeatures.dlna.org:
+// the profile, supported seek operations and transfer modes.
+auto make_dlna_features(std::string_view profile, std::u8string_view mime_type, bool time_seek)
+    -> std::string;
+
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef EEMS_MEDIA_READER_H
+#define EEMS_MEDIA_READER_H
+
+#include <bit>
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Helpers to read media container headers.
+namespace eems
+{
+
+// Big endian.
+inline auto read_uint(std::istream& in, std::uint64_t size) -> std::optional<std::uint64_t>
+{
+    if (size > 8)
+        return std::nullopt;
+    std::uint64_t value = 0;
+    for (std::uint64_t i = 0; i < size; ++i)
+    {
+        auto const c = in.get();
+        if (c == std::istream::traits_type::eof())
+            return std::nullopt;
+        value = (value << 8) | static_cast<unsigned char>(c);
+    }
+    return value;
+}
+
+inline auto read_float(std::istream& in, std::uint64_t size) -> std::optional<double>
+{
+    auto const bits = read_uint(in, size);
+    if (!bits)
+        return std::nullopt;
+    if (size == 4)
+        return std::bit_cast<float>(static_cast<std::uint32_t>(*bits));
+    if (size == 8)
+        return std::bit_cast<double>(*bits);
+    return std::nullopt;
+}
+
+namespace mp4
+{
+// Sample tables of a feature length movie take a few MiB, anything bigger is broken.
+constexpr std::uint64_t max_table_size = 64 * 1024 * 1024;
+
+constexpr auto fourcc(char const (&code)[5]) -> std::uint32_t
+{
+    return (static_cast<std::uint32_t>(code[0]) << 24) | (static_cast<std::uint32_t>(code[1]) << 16) |
+           (static_cast<std::uint32_t>(code[2]) << 8) | static_cast<std::uint32_t>(code[3]);
+}
+
+struct box
+{
+    std::uint32_t type;
+    std::uint64_t data_offset;
+    std::uint64_t size;
+
+    auto end() const { return data_offset + size; }
+};
+
+inline auto read_box(std::istream& in, std::uint64_t position, std::uint64_t parent_end) -> std::optional<box>
+{
+    in.seekg(static_cast<std::streamoff>(position));
+    auto const size = read_uint(in, 4);
+    auto const type = read_uint(in, 4);
+    if (!size || !type)
+        return std::nullopt;
+
+    std::uint64_t header_size = 8;
+    std::uint64_t total_size = *size;
+    if (*size == 1)
+    {
+        auto const large_size = read_uint(in, 8);
+        if (!large_size)
+            return std::nullopt;
+        header_size = 16;
+        total_size = *large_size;
+    }
+    else if (*size == 0)
+    {
+        // Extends to the end of the file.
+        total_size = parent_end - position;
+    }
+    // Compared without adding, a huge size from a corrupted file would wrap around.
+    if (total_size < header_size || position > parent_end || total_size > parent_end - position)
+        return std::nullopt;
+    return box{static_cast<std::uint32_t>(*type), position + header_size, total_size - header_size};
+}
+
+inline auto find_child(std::istream& in, box const& parent, std::uint32_t type) -> std::optional<box>
+{
+    for (auto position = parent.data_offset; position < parent.end();)
+    {
+        auto const child = read_box(in, position, parent.end());
+        if (!child)
+            return std::nullopt;
+        if (child->type == type)
+            return child;
+        position = child->end();
+    }
+    return std::nullopt;
+}
+
+// Contents of a (full) box, big endian.
+class table
+{
+public:
+    auto load(std::istream& in, std::optional<box> const& box) -> bool
+    {
+        if (!box || box->size < 4 || box->size > max_table_size)
+            return false;
+        data_.resize(box->size);
+        in.seekg(static_cast<std::streamoff>(box->data_offset));
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(data_.data()), static_cast<std::streamsize>(data_.size())));
+    }
+
+    auto version() const { return data_[0]; }
+    auto has(std::size_t offset, std::size_t size) const { return offset + size <= data_.size(); }
+
+    // Offsets are from the start of the box data, unread values are 0.
+    auto u8(std::size_t offset) const -> std::uint8_t
+    {
+        return has(offset, 1) ? data_[offset] : 0;
+    }
+    auto u16(std::size_t offset) const -> std::uint16_t
+    {
+        return has(offset, 2) ? static_cast<std::uint16_t>((data_[offset] << 8) | data_[offset + 1]) : 0;
+    }
+    auto u32(std::size_t offset) const -> std::uint32_t
+    {
+        return has(offset, 4) ? (std::uint32_t{data_[offset]} << 24) | (std::uint32_t{data_[offset + 1]} << 16) |
+                                    (std::uint32_t{data_[offset + 2]} << 8) | data_[offset + 3]
+                              : 0;
+    }
+    auto u64(std::size_t offset) const -> std::uint64_t
+    {
+        return (std::uint64_t{u32(offset)} << 32) | u32(offset + 4);
+    }
+
+private:
+    std::vector<std::uint8_t> data_;
+};
+
+// Time scale and duration from mvhd or mdhd.
+inline auto read_header(std::istream& in, std::optional<box> const& header) -> std::pair<std::uint32_t, std::uint64_t>
+{
+    table data;
+    if (!data.load(in, header))
+        return {0, 0};
+    if (data.version() == 1)
+        return {data.u32(20), data.u64(24)};
+    return {data.u32(12), data.u32(16)};
+}
+}
+
+}
+
+#endif
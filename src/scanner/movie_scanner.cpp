@@ -1,10 +1,12 @@
 #include "movie_scanner.h"
 
 #include "../ranges.h"
-#include "../spirit.h"
 #include "../store/fb_converters.h"
+#include "artwork_scaler.h"
+#include "dlna_profile.h"
+#include "seek_index.h"
+#include "title_parser.h"
 
-#include <boost/algorithm/string/trim.hpp>
 #include <chrono>
 #include <date/date.h>
 #include <fmt/ostream.h>
@@ -14,9 +16,7 @@
 #include <range/v3/action/push_back.hpp>
 #include <range/v3/algorithm/find_if.hpp>
 #include <range/v3/algorithm/for_each.hpp>
-#include <range/v3/range/conversion.hpp>
 #include <range/v3/view/transform.hpp>
-#include <regex>
 #include <spdlog/spdlog.h>
 #include <unordered_map>
 
@@ -36,6 +36,14 @@ struct hasher
     }
 };
 
+inline auto copy_to_arena(buffer_view buf, std::pmr::memory_resource& arena)
+    -> buffer_view
+{
+    auto data = static_cast<uint8_t*>(arena.allocate(buf.size(), alignof(std::max_align_t)));
+    std::memcpy(data, buf.data(), buf.size());
+    return {data, buf.size()};
+}
+
 }
 
 auto get_mime_type(fs::path const& path)
@@ -73,23 +81,6 @@ inline auto is_text_type(std::u8string_view mime_type)
     return mime_type.starts_with(u8"text/");
 }
 
-auto normalize_title(std::u8string title) -> std::tuple<std::string, int>
-{
-    // TODO: This is a bit messy because std::regex doesn't support unicode.
-    static std::regex const re_wordsep{"[\\._](?=\\w)"};
-    static std::regex const re_year("\\(?([12]\\d{3})\\)?");
-
-    auto ntitle = std::regex_replace(reinterpret_cast<char const*>(title.c_str()), re_wordsep, " ");
-    int year = 0;
-    if (std::smatch m; std::regex_search(ntitle, m, re_year))
-    {
-        parse(std::basic_string_view{m[1].first, m[1].second}, x3::int64, year);
-        ntitle.erase(m[0].first, ntitle.end());
-    }
-    boost::algorithm::trim(ntitle);
-    return {std::move(ntitle), year};
-}
-
 inline auto classify_artwork(std::u8string_view name)
     -> std::optional<ArtworkType>
 {
@@ -102,11 +93,14 @@ inline auto classify_artwork(std::u8string_view name)
 }
 
 inline auto CreateResourceRef(flatbuffers::FlatBufferBuilder& fbb,
-                              std::string const& key, file_info const& info)
+                              std::string const& key, Resource const& resource)
     -> flatbuffers::Offset<ResourceRef>
 {
     auto key_off = CreateLibraryKey(fbb, key);
-    auto protocol_info = put_string(fmt::format(u8"http-get:*:{}:*", info.mime_type), fbb);
+    auto protocol_info = put_string(fmt::format("http-get:*:{}:{}",
+                                                as_string_view<char>(*resource.mime_type()),
+                                                resource.dlna_features() ? as_string_view<char>(*resource.dlna_features()) : "*"),
+                                    fbb);
     ResourceRefBuilder ref_builder{fbb};
     ref_builder.add_ref(key_off);
     ref_builder.add_protocol_info(protocol_info);
@@ -116,13 +110,23 @@ inline auto CreateResourceRef(flatbuffers::FlatBufferBuilder& fbb,
 struct object_composer
 {
     movie_scanner& context;
+    // Keeps finished objects until they are stored.
+    std::pmr::memory_resource& arena;
     std::u8string folder_name;
 
-    std::vector<std::tuple<ResourceKey, flatbuffers::DetachedBuffer>> resources;
+    using resource_list = std::pmr::vector<std::tuple<ResourceKey, buffer_view>>;
+
+    resource_list resources{&arena};
     std::map<std::u8string, file_info, std::less<>> subtitles_;
     std::map<std::u8string, file_info, std::less<>> artwork_;
+    // Folder artwork is shared by all items, so it's stored (and scaled) only once.
+    std::map<fs::path, artwork_meta> stored_artwork_;
     ObjectKey parent_id;
 
+    // Reused for every item.
+    std::pmr::vector<flatbuffers::Offset<ResourceRef>> item_resources_{&arena};
+    std::pmr::vector<flatbuffers::Offset<Artwork>> item_artwork_{&arena};
+
     auto artwork(fs::path const& path, std::u8string_view mime_type)
         -> void
     {
@@ -140,17 +144,19 @@ struct object_composer
     }
 
     auto operator()(std::pair<fs::path, file_info> const& p)
-        -> flatbuffers::DetachedBuffer
+        -> buffer_view
     {
         auto& [name, info] = p;
 
-        std::vector<flatbuffers::Offset<ResourceRef>> item_resources;
-        std::vector<flatbuffers::Offset<Artwork>> item_artwork;
-        flatbuffers::FlatBufferBuilder fbb{};
+        auto& item_resources = item_resources_;
+        auto& item_artwork = item_artwork_;
+        auto& fbb = context.item_fbb_;
+        item_resources.clear();
+        item_artwork.clear();
+        fbb.Clear();
 
         // Main resource.
-        item_resources.emplace_back(
-            CreateResourceRef(fbb, store_resource(info), info));
+        item_resources.emplace_back(add_resource(fbb, info));
 
         flatbuffers::Offset<MediaObjectRef> album_art{};
 
@@ -167,9 +173,7 @@ struct object_composer
             {
                 spdlog::debug("Detected item artwork type {}", EnumNameArtworkType(*art_type));
                 item_artwork.emplace_back(
-                    CreateArtwork(fbb,
-                                  CreateLibraryKey(fbb, store_resource(art_it->second)),
-                                  *art_type));
+                    create_artwork(fbb, store_artwork(art_it->second, *art_type, resources)));
             }
         }
         if (item_artwork.empty())
@@ -178,9 +182,7 @@ struct object_composer
             {
                 spdlog::debug("No item artworkm Adding folder artwork");
                 item_artwork.emplace_back(
-                    CreateArtwork(fbb,
-                                  CreateLibraryKey(fbb, store_resource(folder_artwork->second)),
-                                  art_type));
+                    create_artwork(fbb, store_artwork(folder_artwork->second, art_type, resources)));
             }
         }
 
@@ -189,15 +191,17 @@ struct object_composer
             if (!subs_it->first.starts_with(resource_prefix))
                 break;
 
-            item_resources.emplace_back(
-                CreateResourceRef(fbb, store_resource(subs_it->second), subs_it->second));
+            item_resources.emplace_back(add_resource(fbb, subs_it->second));
         }
 
-        auto data_off = CreateMediaItem(fbb, fbb.CreateVector(item_resources));
+        auto data_off = CreateMediaItem(fbb, put_vector(fbb, item_resources));
         // NOTE: Normally partition is enough, but FB offers only this API 😥
         auto artwork_off = put_sorted_vector(fbb, std::move(item_artwork));
-        auto [title, year] = normalize_title(folder_name.empty() ? resource_prefix : folder_name);
-        auto dc_title = put_string(title, fbb);
+        auto const release = parse_release_name(folder_name.empty() ? resource_prefix : folder_name);
+        spdlog::debug("Parsed release: {} ({}) {} {} {} {}", release.title, release.year,
+                      release.resolution, release.source, release.video_codec, release.audio_codec);
+        auto const year = release.year;
+        auto dc_title = put_string(release.title, fbb);
         auto upnp_class = put_string_view(upnp_movie_class, fbb);
 
         auto object_builder = MediaObjectBuilder(fbb);
@@ -219,13 +223,44 @@ struct object_composer
         object_builder.add_data_type(ObjectUnion::MediaItem);
         object_builder.add_data(data_off.Union());
         fbb.Finish(object_builder.Finish());
-        return fbb.Release();
+        return copy_to_arena(finished_buffer(fbb), arena);
+    }
+
+    // Stores the resource and references it from the item being built.
+    auto add_resource(flatbuffers::FlatBufferBuilder& fbb, file_info const& info) -> flatbuffers::Offset<ResourceRef>
+    {
+        auto const res_key = store_resource(info, resources);
+        auto const& resource = *flatbuffers::GetRoot<Resource>(std::get<buffer_view>(resources.back()).data());
+        return CreateResourceRef(fbb, serialize_key(res_key), resource);
+    }
+
+    auto store_resource(file_info const& info, resource_list& target) -> ResourceKey
+    {
+        auto const [res_key, res_buf] = context.serialize_resource(info);
+        target.emplace_back(res_key, copy_to_arena(res_buf, arena));
+        return res_key;
     }
 
-    auto store_resource(file_info const& info) -> std::string
+    // Stores the artwork along with its downscaled variants, which are kept in the artwork cache between scans.
+    auto store_artwork(file_info const& info, ArtworkType type, resource_list& target) -> artwork_meta const&
     {
-        auto& res = resources.emplace_back(context.serialize_resource(info));
-        return serialize_key(std::get<ResourceKey>(res));
+        auto [it, inserted] = stored_artwork_.try_emplace(info.path);
+        auto& stored = it->second;
+        if (!inserted)
+            return stored;
+
+        auto const res_key = store_resource(info, target);
+        stored.key = serialize_key(res_key);
+        stored.type = type;
+        if (!context.artwork_cache_.empty())
+        {
+            for (auto& variant : get_scaled_artwork(info.path, context.artwork_cache_))
+            {
+                auto const variant_key = store_resource(file_info{info.mime_type, std::move(variant.path)}, target);
+                stored.variants.emplace_back(serialize_key(variant_key), variant.profile);
+            }
+        }
+        return stored;
     }
 
     auto get_folder_artwork() -> std::pair<std::pair<std::u8string const, file_info> const*, ArtworkType>
@@ -245,21 +280,27 @@ struct object_composer
     }
 };
 
-auto movie_scanner::scan_directory(fs::path const& path, movies_library_config const& config, ObjectKey parent)
-    -> std::vector<std::tuple<fs::path, ObjectKey>>
+auto movie_scanner::scan_directory(pending_directory const& directory, movies_library_config const& config)
+    -> void
 {
+    auto const& path = directory.path;
+    auto const parent = directory.parent_id;
     spdlog::info("Scanning for movies: {}", path);
 
-    std::vector<std::tuple<fs::path, ObjectKey>> directories{};
+    std::vector<pending_directory> directories{};
 
     std::map<fs::path, file_info> videos;
-    object_composer composer{.context = *this, .parent_id = parent};
+    // Lives for the directory, everything composed for the store is allocated from it.
+    std::pmr::monotonic_buffer_resource arena{arena_buffer_.data(), arena_buffer_.size()};
+    object_composer composer{.context = *this, .arena = arena, .parent_id = parent};
 
-    for (auto item : fs::directory_iterator{path})
+    std::error_code ec;
+    for (auto it = fs::directory_iterator{path, ec}; !ec && it != fs::directory_iterator{}; it.increment(ec))
     {
+        auto const& item = *it;
         if (item.is_directory())
         {
-            directories.emplace_back(item, parent);
+            directories.push_back({.path{item.path()}, .parent_id{parent}});
             continue;
         }
         else if (!item.is_regular_file())
@@ -293,7 +334,13 @@ auto movie_scanner::scan_directory(fs::path const& path, movies_library_config c
         }
     }
 
-    if (config.use_collections)
+    if (ec)
+    {
+        // Don't fail the whole scan, otherwise resuming would stumble on the same directory forever.
+        spdlog::warn("Failed to scan {}: {}", path, ec.message());
+    }
+
+    if (config.use_collections && directory.use_collections)
     {
         auto const artwork = composer.get_folder_artwork();
 
@@ -309,17 +356,35 @@ auto movie_scanner::scan_directory(fs::path const& path, movies_library_config c
 
         if (add_collection)
         {
-            composer.parent_id = create_container(
-                path.stem().generic_u8string(),
-                {artwork.first ? &artwork.first->second : nullptr, artwork.second},
-                parent);
+            if (directory.collection_id)
+            {
+                spdlog::debug("Reusing collection {} from interrupted scan", directory.collection_id->id());
+                composer.parent_id = *directory.collection_id;
+            }
+            else
+            {
+                // Record the collection in the journal, so it's not created twice if the scan is resumed from here.
+                auto& collection_id = journal_.pending.back().collection_id;
+                collection_id = next_object_key();
+                composer.parent_id = *collection_id;
+
+                container_meta meta{
+                    .id{composer.parent_id},
+                    .parent_id{parent},
+                    .dc_title{path.stem().generic_u8string()},
+                    .upnp_class{upnp_container_class}};
+                object_composer::resource_list artwork_resources{&arena};
+                if (artwork.first)
+                    meta.artwork.push_back(composer.store_artwork(artwork.first->second, artwork.second, artwork_resources));
+                create_container(meta, artwork_resources);
+            }
 
             if (artwork.first)
             {
-                ranges::for_each(directories, [collection_key = composer.parent_id](auto& tup)
+                ranges::for_each(directories, [collection_key = composer.parent_id](pending_directory& dir)
                                  {
-                                     spdlog::debug("Assigned parent {} to {}", collection_key.id(), std::get<fs::path>(tup));
-                                     std::get<ObjectKey>(tup) = collection_key; });
+                                     spdlog::debug("Assigned parent {} to {}", collection_key.id(), dir.path);
+                                     dir.parent_id = collection_key; });
             }
         }
     }
@@ -327,33 +392,82 @@ auto movie_scanner::scan_directory(fs::path const& path, movies_library_config c
     if (config.use_folder_names && videos.size() == 1)
         composer.folder_name = path.stem().u8string();
 
+    // This directory is done: its subdirectories become pending and are committed along with the items.
+    journal_.pending.pop_back();
+    ranges::push_back(journal_.pending, directories);
+    journal_.last_directory = path;
+
     if (videos.size() > 0)
     {
-        store_.put_items(
-            composer.parent_id,
-            views::transform(videos, std::ref(composer)) | ranges::to<std::vector>(),
-            std::move(composer.resources));
+        std::pmr::vector<buffer_view> items{&arena};
+        items.reserve(videos.size());
+        ranges::push_back(items, views::transform(videos, std::ref(composer)));
+        store_.put_items(composer.parent_id, items, composer.resources, &journal_);
+    }
+    else
+    {
+        store_.put_scan_journal(journal_);
     }
+}
 
-    return directories;
+auto movie_scanner::start_scan(ScanJournalKey library, fs::path const& root) -> void
+{
+    load_next_ids();
+    // Collections are not created for the library root.
+    journal_ = scan_journal{
+        .id{library},
+        .root{root},
+        .pending{{.path{root}, .parent_id{get_movies_folder_id()}, .use_collections{false}}}};
+    store_.put_scan_journal(journal_);
 }
 
-auto movie_scanner::scan_all(fs::path const& root, movies_library_config const& original_config) -> void
+auto movie_scanner::scan_all(ScanJournalKey library, fs::path const& root, movies_library_config const& config) -> void
 {
-    next_resource_id_ = store_.get_next_id<ResourceKey>();
-    next_object_id_ = store_.get_next_id<ObjectKey>();
-    auto directories = std::vector<std::tuple<fs::path, ObjectKey>>{{root, get_movies_folder_id()}};
+    auto journal = store_.get_scan_journal(library);
+    if (!journal)
+    {
+        // Never started, possibly because the process stopped before it got to this library.
+        start_scan(library, root);
+        journal = journal_;
+    }
+    else if (journal->completed())
+    {
+        spdlog::debug("Library {} is already scanned", root);
+        return;
+    }
+    if (journal->root != root)
+    {
+        spdlog::warn("Library {} has an interrupted scan of {}, not resuming", root, journal->root);
+        return;
+    }
+    if (journal->last_directory.empty())
+    {
+        spdlog::info("Scanning library: {}", root);
+    }
+    else
+    {
+        spdlog::info("Resuming scan of {} after {}", root, journal->last_directory);
+    }
+
+    if (!artwork_cache_.empty())
+    {
+        std::error_code ec;
+        if (fs::create_directories(artwork_cache_, ec); ec)
+        {
+            spdlog::warn("Can't create artwork cache {}: {}, artwork won't be scaled", artwork_cache_, ec.message());
+            artwork_cache_.clear();
+        }
+    }
 
-    auto config = original_config;
-    config.use_collections = false;
-    while (!directories.empty())
+    journal_ = std::move(*journal);
+    load_next_ids();
+    while (!journal_.completed())
     {
-        auto& [path, parent] = directories.back();
-        auto new_directories = scan_directory(path, config, parent);
-        directories.pop_back();
-        ranges::push_back(directories, new_directories);
-        config.use_collections = original_config.use_collections;
+        // Copy, because scanning updates the journal.
+        auto const directory = journal_.pending.back();
+        scan_directory(directory, config);
     }
+    remove_stale_artwork(artwork_cache_, root);
 }
 
 auto movie_scanner::get_movies_folder_id() -> ObjectKey
@@ -373,7 +487,8 @@ auto movie_scanner::get_movies_folder_id() -> ObjectKey
         }
     }
 
-    flatbuffers::FlatBufferBuilder fbb{};
+    auto& fbb = item_fbb_;
+    fbb.Clear();
 
     auto const new_key = next_object_key();
 
@@ -390,54 +505,65 @@ auto movie_scanner::get_movies_folder_id() -> ObjectKey
     builder.add_data(container_off.Union());
 
     fbb.Finish(builder.Finish());
-    std::vector<flatbuffers::DetachedBuffer> items;
-    items.emplace_back(fbb.Release());
-    store_.put_items(root_key, std::move(items), {});
+    auto const item = finished_buffer(fbb);
+    store_.put_items(root_key, {&item, 1}, {});
 
     return movies_folder_ = new_key;
 }
 
-auto movie_scanner::create_container(std::u8string_view name,
-                                     std::tuple<file_info const*, ArtworkType> artwork,
-                                     ObjectKey parent)
-    -> ObjectKey
+auto movie_scanner::create_container(container_meta const& meta,
+                                     std::span<std::tuple<ResourceKey, buffer_view> const> resources)
+    -> void
 {
-    std::vector<flatbuffers::DetachedBuffer> items;
-    std::vector<std::tuple<ResourceKey, flatbuffers::DetachedBuffer>> resources;
-
-    container_meta meta{
-        .id{next_object_key()},
-        .parent_id{parent},
-        .dc_title{std::u8string{name}},
-        .upnp_class{upnp_container_class}};
+    item_fbb_.Clear();
+    auto const item = serialize_container(item_fbb_, {}, meta);
 
-    if (auto [info, art_type] = artwork; info)
-    {
-        auto& [res_key, res_buf] = resources.emplace_back(serialize_resource(*info));
-        meta.artwork.emplace_back(serialize_key(res_key), art_type);
-    }
-
-    items.emplace_back(serialize_container({}, meta));
-
-    store_.put_items(meta.parent_id, std::move(items), std::move(resources));
-
-    return meta.id;
+    store_.put_items(meta.parent_id, {&item, 1}, resources, &journal_);
 }
 
 auto movie_scanner::serialize_resource(file_info const& info)
-    -> std::tuple<ResourceKey, flatbuffers::DetachedBuffer>
+    -> std::tuple<ResourceKey, buffer_view>
 {
-    flatbuffers::FlatBufferBuilder resource_fbb{};
+    auto& resource_fbb = resource_fbb_;
+    resource_fbb.Clear();
     auto const location = put_string(info.path.native(), resource_fbb);
     auto const mime = put_string_view(info.mime_type, resource_fbb);
+    seek_index index{};
+    flatbuffers::Offset<flatbuffers::Vector<SeekPoint const*>> seek_points{};
+    if (is_video_type(info.mime_type))
+    {
+        index = read_seek_index(info.path, info.mime_type);
+        if (!index.points.empty())
+        {
+            std::vector<SeekPoint> points;
+            points.reserve(index.points.size());
+            for (auto const& point : index.points)
+            {
+                points.emplace_back(point.time.count(), point.offset);
+            }
+            seek_points = resource_fbb.CreateVectorOfStructs(points);
+        }
+    }
+    auto const dlna_features = put_string(make_dlna_features(detect_dlna_profile(info.path, info.mime_type),
+                                                             info.mime_type, !index.points.empty()),
+                                          resource_fbb);
 
     ResourceBuilder resource_builder{resource_fbb};
     resource_builder.add_location(location);
     resource_builder.add_mime_type(mime);
+    resource_builder.add_duration(index.duration.count());
+    resource_builder.add_seek_index(seek_points);
+    resource_builder.add_dlna_features(dlna_features);
     resource_fbb.Finish(resource_builder.Finish());
     auto const resource_key = next_resource_key();
     spdlog::info("Assigning resource key: {} to {}", resource_key.id(), info.path);
-    return {resource_key, resource_fbb.Release()};
+    return {resource_key, finished_buffer(resource_fbb)};
+}
+
+inline auto movie_scanner::load_next_ids() -> void
+{
+    next_resource_id_ = store_.get_next_id<ResourceKey>();
+    next_object_id_ = store_.get_next_id<ObjectKey>();
 }
 
 inline auto movie_scanner::next_resource_key() -> ResourceKey
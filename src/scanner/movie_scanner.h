@@ -5,6 +5,8 @@
 #include "../fs.h"
 #include "../store/store_service.h"
 
+#include <memory_resource>
+
 namespace eems
 {
 
@@ -17,28 +19,37 @@ struct file_info
 class movie_scanner
 {
 public:
-    explicit movie_scanner(store_service& store)
+    // Downscaled artwork is written to the artwork cache directory, it's not created when empty.
+    explicit movie_scanner(store_service& store, fs::path artwork_cache = {})
         : store_{store}
+        , artwork_cache_{std::move(artwork_cache)}
     {
     }
 
-    auto scan_all(fs::path const& root, movies_library_config const& config)
+    // Records a pending scan of the library, so it's picked up by scan_all()
+    // even if the process is interrupted before the first directory is scanned.
+    auto start_scan(ScanJournalKey library, fs::path const& root)
+        -> void;
+
+    // Scans (or resumes scanning) the library recorded by start_scan(), a library without a record is started.
+    auto scan_all(ScanJournalKey library, fs::path const& root, movies_library_config const& config)
         -> void;
 
 private:
-    auto scan_directory(fs::path const& path, movies_library_config const& config, ObjectKey parent)
-        -> std::vector<std::tuple<fs::path, ObjectKey>>;
+    auto scan_directory(pending_directory const& directory, movies_library_config const& config)
+        -> void;
 
-    auto create_container(std::u8string_view name,
-                          std::tuple<file_info const*, ArtworkType> artwork,
-                          ObjectKey parent)
-        -> ObjectKey;
+    auto create_container(container_meta const& meta,
+                          std::span<std::tuple<ResourceKey, buffer_view> const> resources)
+        -> void;
 
+    // Returned buffer is valid until the next call.
     auto serialize_resource(file_info const& info)
-        -> std::tuple<ResourceKey, flatbuffers::DetachedBuffer>;
+        -> std::tuple<ResourceKey, buffer_view>;
 
     auto get_movies_folder_id() -> ObjectKey;
 
+    auto load_next_ids() -> void;
     auto next_resource_key() -> ResourceKey;
     auto next_object_key() -> ObjectKey;
 
@@ -46,6 +57,14 @@ private:
 
 private:
     store_service& store_;
+    fs::path artwork_cache_;
+    scan_journal journal_;
+    // Builders are reused (cleared) for every object; resources are built
+    // while an item is being composed, so they need a builder of their own.
+    flatbuffers::FlatBufferBuilder item_fbb_{};
+    flatbuffers::FlatBufferBuilder resource_fbb_{};
+    // Initial block of the per-directory arena which keeps finished objects until they are stored.
+    std::vector<std::byte> arena_buffer_ = std::vector<std::byte>(64 * 1024);
     ObjectKey movies_folder_{-1};
     int64_t next_resource_id_{-1};
     int64_t next_object_id_{-1};
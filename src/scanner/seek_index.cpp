@@ -0,0 +1,359 @@
+#include "seek_index.h"
+
+#include "media_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fmt/chrono.h>
+#include <fmt/std.h>
+#include <fstream>
+#include <optional>
+#include <spdlog/spdlog.h>
+
+namespace eems
+{
+
+namespace
+{
+// Renderers can't seek more precisely than that anyway, and it keeps the index small.
+constexpr auto min_point_distance = std::chrono::seconds(1);
+constexpr std::size_t max_points = 16 * 1024;
+
+auto thin_out(std::vector<seek_point> points) -> std::vector<seek_point>
+{
+    std::sort(points.begin(), points.end(), [](auto const& lhs, auto const& rhs)
+              { return lhs.time < rhs.time; });
+    std::vector<seek_point> result;
+    for (auto const& point : points)
+    {
+        if (result.empty() || point.time - result.back().time >= min_point_distance)
+            result.push_back(point);
+    }
+    if (result.size() > max_points)
+    {
+        auto const step = (result.size() + max_points - 1) / max_points;
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < result.size(); i += step)
+            result[kept++] = result[i];
+        result.resize(kept);
+    }
+    return result;
+}
+
+// Matroska
+
+namespace ebml
+{
+constexpr std::uint32_t header_id = 0x1A45DFA3;
+constexpr std::uint32_t segment_id = 0x18538067;
+constexpr std::uint32_t seek_head_id = 0x114D9B74;
+constexpr std::uint32_t seek_id = 0x4DBB;
+constexpr std::uint32_t seek_id_id = 0x53AB;
+constexpr std::uint32_t seek_position_id = 0x53AC;
+constexpr std::uint32_t info_id = 0x1549A966;
+constexpr std::uint32_t timecode_scale_id = 0x2AD7B1;
+constexpr std::uint32_t duration_id = 0x4489;
+constexpr std::uint32_t cluster_id = 0x1F43B675;
+constexpr std::uint32_t cues_id = 0x1C53BB6B;
+constexpr std::uint32_t cue_point_id = 0xBB;
+constexpr std::uint32_t cue_time_id = 0xB3;
+constexpr std::uint32_t cue_track_positions_id = 0xB7;
+constexpr std::uint32_t cue_cluster_position_id = 0xF1;
+
+constexpr auto unknown_size = ~std::uint64_t{0};
+
+struct element
+{
+    std::uint32_t id;
+    std::uint64_t data_offset;
+    std::uint64_t size;
+
+    auto end() const { return data_offset + size; }
+};
+
+// Variable size integer, IDs keep their length marker.
+auto read_vint(std::istream& in, bool is_id) -> std::optional<std::uint64_t>
+{
+    auto const first = in.get();
+    if (first == std::istream::traits_type::eof() || first == 0)
+        return std::nullopt;
+    auto const length = std::countl_zero(static_cast<unsigned char>(first)) + 1;
+    if (is_id && length > 4)
+        return std::nullopt;
+
+    auto const marker = 0x80u >> (length - 1);
+    std::uint64_t value = is_id ? first : first & (marker - 1);
+    auto all_ones = value == marker - 1;
+    for (int i = 1; i < length; ++i)
+    {
+        auto const c = in.get();
+        if (c == std::istream::traits_type::eof())
+            return std::nullopt;
+        value = (value << 8) | static_cast<unsigned char>(c);
+        all_ones = all_ones && c == 0xff;
+    }
+    return !is_id && all_ones ? unknown_size : value;
+}
+
+auto read_element(std::istream& in, std::uint64_t position) -> std::optional<element>
+{
+    in.seekg(static_cast<std::streamoff>(position));
+    auto const id = read_vint(in, true);
+    auto const size = id ? read_vint(in, false) : std::nullopt;
+    if (!size)
+        return std::nullopt;
+    return element{static_cast<std::uint32_t>(*id), static_cast<std::uint64_t>(in.tellg()), *size};
+}
+
+// Calls func with each child positioned at its data, stops at the first malformed one.
+template <typename F>
+auto for_each_child(std::istream& in, element const& parent, F func) -> void
+{
+    for (auto position = parent.data_offset; position < parent.end();)
+    {
+        auto const child = read_element(in, position);
+        if (!child || child->size == unknown_size || child->end() > parent.end())
+            return;
+        func(*child);
+        position = child->end();
+    }
+}
+}
+
+auto read_matroska_index(std::istream& in, std::uint64_t file_size) -> seek_index
+{
+    seek_index result{};
+    auto const header = ebml::read_element(in, 0);
+    if (!header || header->id != ebml::header_id || header->size == ebml::unknown_size)
+        return result;
+    auto const segment = ebml::read_element(in, header->end());
+    if (!segment || segment->id != ebml::segment_id)
+        return result;
+
+    // Positions are relative to the segment data.
+    auto const segment_start = segment->data_offset;
+    auto const segment_end = segment->size == ebml::unknown_size ? file_size : std::min(file_size, segment->end());
+    std::uint64_t timecode_scale = 1'000'000;
+    double duration = 0;
+    std::optional<std::uint64_t> cues_position;
+
+    // Only the elements before the first cluster are read, Cues are usually at the end and found through SeekHead.
+    for (auto position = segment_start; position < segment_end;)
+    {
+        auto const element = ebml::read_element(in, position);
+        if (!element || element->size == ebml::unknown_size || element->id == ebml::cluster_id)
+            break;
+
+        switch (element->id)
+        {
+        case ebml::seek_head_id:
+            ebml::for_each_child(in, *element, [&](ebml::element const& seek)
+                                 {
+                                     if (seek.id != ebml::seek_id)
+                                         return;
+                                     std::optional<std::uint64_t> id, target;
+                                     ebml::for_each_child(in, seek, [&](ebml::element const& field)
+                                                          {
+                                                              if (field.id == ebml::seek_id_id)
+                                                                  id = read_uint(in, field.size);
+                                                              else if (field.id == ebml::seek_position_id)
+                                                                  target = read_uint(in, field.size);
+                                                          });
+                                     if (id == ebml::cues_id && target)
+                                         cues_position = segment_start + *target;
+                                 });
+            break;
+        case ebml::info_id:
+            ebml::for_each_child(in, *element, [&](ebml::element const& field)
+                                 {
+                                     if (field.id == ebml::timecode_scale_id)
+                                         timecode_scale = read_uint(in, field.size).value_or(timecode_scale);
+                                     else if (field.id == ebml::duration_id)
+                                         duration = read_float(in, field.size).value_or(0);
+                                 });
+            break;
+        case ebml::cues_id:
+            cues_position = position;
+            break;
+        }
+        position = element->end();
+    }
+
+    result.duration = std::chrono::milliseconds{static_cast<std::int64_t>(duration * timecode_scale / 1'000'000)};
+    auto const cues = cues_position ? ebml::read_element(in, *cues_position) : std::nullopt;
+    if (!cues || cues->id != ebml::cues_id || cues->size == ebml::unknown_size)
+        return result;
+
+    std::vector<seek_point> points;
+    ebml::for_each_child(in, *cues, [&](ebml::element const& cue_point)
+                         {
+                             if (cue_point.id != ebml::cue_point_id)
+                                 return;
+                             std::optional<std::uint64_t> time, cluster;
+                             ebml::for_each_child(in, cue_point, [&](ebml::element const& field)
+                                                  {
+                                                      if (field.id == ebml::cue_time_id)
+                                                      {
+                                                          time = read_uint(in, field.size);
+                                                      }
+                                                      else if (field.id == ebml::cue_track_positions_id && !cluster)
+                                                      {
+                                                          // The first track is normally the video.
+                                                          ebml::for_each_child(in, field, [&](ebml::element const& position)
+                                                                               {
+                                                                                   if (position.id == ebml::cue_cluster_position_id)
+                                                                                       cluster = read_uint(in, position.size);
+                                                                               });
+                                                      }
+                                                  });
+                             if (time && cluster && segment_start + *cluster < file_size)
+                             {
+                                 points.push_back({std::chrono::milliseconds{static_cast<std::int64_t>(*time * timecode_scale / 1'000'000)},
+                                                   segment_start + *cluster});
+                             }
+                         });
+    result.points = thin_out(std::move(points));
+    return result;
+}
+
+// MP4
+
+auto read_track_index(std::istream& in, mp4::box const& stbl, std::uint32_t timescale) -> std::vector<seek_point>
+{
+    std::vector<seek_point> points;
+    mp4::table stts, stss, stsc, stsz, chunks;
+    auto const has_stss = stss.load(in, mp4::find_child(in, stbl, mp4::fourcc("stss")));
+    auto const is_co64 = !chunks.load(in, mp4::find_child(in, stbl, mp4::fourcc("stco")));
+    if (!stts.load(in, mp4::find_child(in, stbl, mp4::fourcc("stts"))) ||
+        !stsc.load(in, mp4::find_child(in, stbl, mp4::fourcc("stsc"))) ||
+        !stsz.load(in, mp4::find_child(in, stbl, mp4::fourcc("stsz"))) ||
+        (is_co64 && !chunks.load(in, mp4::find_child(in, stbl, mp4::fourcc("co64")))) ||
+        !timescale)
+    {
+        return points;
+    }
+
+    auto const stts_count = stts.u32(4);
+    auto const stss_count = has_stss ? stss.u32(4) : 0;
+    auto const stsc_count = stsc.u32(4);
+    auto const sample_size = stsz.u32(4);
+    auto const sample_count = stsz.u32(8);
+    auto const chunk_count = chunks.u32(4);
+    auto const chunk_offset = [&](std::uint32_t chunk) -> std::uint64_t
+    {
+        return is_co64 ? chunks.u64(8 + std::size_t{chunk} * 8) : chunks.u32(8 + std::size_t{chunk} * 4);
+    };
+    if (!stts_count || !stsc_count || !chunk_count || !stsz.has(12, sample_size ? 0 : std::size_t{sample_count} * 4))
+        return points;
+
+    // Walks all samples, tracking their time (stts), chunk (stsc) and offset in the chunk (stsz).
+    std::uint32_t stts_entry = 0, stts_left = stts.u32(8);
+    std::uint64_t time = 0;
+    std::uint32_t stsc_entry = 0, chunk = 0, sample_in_chunk = 0;
+    auto samples_per_chunk = stsc.u32(12);
+    std::uint32_t sync_entry = 0;
+    auto offset = chunk_offset(0);
+    for (std::uint32_t sample = 1; sample <= sample_count && samples_per_chunk; ++sample)
+    {
+        // Without stss every sample is a keyframe.
+        auto is_sync = !has_stss;
+        while (sync_entry < stss_count && stss.u32(8 + std::size_t{sync_entry} * 4) < sample)
+            ++sync_entry;
+        if (sync_entry < stss_count && stss.u32(8 + std::size_t{sync_entry} * 4) == sample)
+            is_sync = true;
+        if (is_sync)
+        {
+            points.push_back({std::chrono::milliseconds{static_cast<std::int64_t>(time * 1000 / timescale)}, offset});
+        }
+
+        offset += sample_size ? sample_size : stsz.u32(12 + std::size_t{sample - 1} * 4);
+        time += stts.u32(12 + std::size_t{stts_entry} * 8);
+        if (stts_left && !--stts_left)
+        {
+            do
+            {
+                if (++stts_entry >= stts_count)
+                    break;
+                stts_left = stts.u32(8 + std::size_t{stts_entry} * 8);
+            } while (!stts_left);
+        }
+
+        if (++sample_in_chunk == samples_per_chunk)
+        {
+            sample_in_chunk = 0;
+            if (++chunk >= chunk_count)
+                break;
+            offset = chunk_offset(chunk);
+            // First chunks in stsc are 1-based.
+            if (stsc_entry + 1 < stsc_count && stsc.u32(8 + std::size_t{stsc_entry + 1} * 12) == chunk + 1)
+            {
+                ++stsc_entry;
+                samples_per_chunk = stsc.u32(12 + std::size_t{stsc_entry} * 12);
+            }
+        }
+    }
+    return points;
+}
+
+auto read_mp4_index(std::istream& in, std::uint64_t file_size) -> seek_index
+{
+    seek_index result{};
+    auto const file = mp4::box{0, 0, file_size};
+    auto const moov = mp4::find_child(in, file, mp4::fourcc("moov"));
+    if (!moov)
+        return result;
+
+    if (auto const [timescale, duration] = mp4::read_header(in, mp4::find_child(in, *moov, mp4::fourcc("mvhd"))); timescale)
+    {
+        result.duration = std::chrono::milliseconds{static_cast<std::int64_t>(duration * 1000 / timescale)};
+    }
+
+    for (auto position = moov->data_offset; position < moov->end();)
+    {
+        auto const trak = mp4::read_box(in, position, moov->end());
+        if (!trak)
+            break;
+        position = trak->end();
+        if (trak->type != mp4::fourcc("trak"))
+            continue;
+
+        auto const mdia = mp4::find_child(in, *trak, mp4::fourcc("mdia"));
+        mp4::table hdlr;
+        if (!mdia || !hdlr.load(in, mp4::find_child(in, *mdia, mp4::fourcc("hdlr"))) || hdlr.u32(8) != mp4::fourcc("vide"))
+            continue;
+        auto const minf = mp4::find_child(in, *mdia, mp4::fourcc("minf"));
+        auto const stbl = minf ? mp4::find_child(in, *minf, mp4::fourcc("stbl")) : std::nullopt;
+        if (!stbl)
+            continue;
+
+        auto const [timescale, duration] = mp4::read_header(in, mp4::find_child(in, *mdia, mp4::fourcc("mdhd")));
+        result.points = thin_out(read_track_index(in, *stbl, timescale));
+        break;
+    }
+    return result;
+}
+
+}
+
+auto read_seek_index(fs::path const& path, std::u8string_view mime_type)
+    -> seek_index
+{
+    auto const is_matroska = mime_type == u8"video/x-matroska";
+    if (!is_matroska && mime_type != u8"video/mp4")
+        return {};
+
+    std::error_code ec;
+    auto const file_size = fs::file_size(path, ec);
+    std::ifstream in{path, std::ios::binary};
+    if (ec || !in)
+    {
+        spdlog::warn("Can't read seek index of {}", path);
+        return {};
+    }
+
+    auto result = is_matroska ? read_matroska_index(in, file_size) : read_mp4_index(in, file_size);
+    spdlog::debug("Seek index of {}: {} points, {}", path, result.points.size(), result.duration);
+    return result;
+}
+
+}
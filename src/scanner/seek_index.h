@@ -0,0 +1,35 @@
+#ifndef EEMS_SEEK_INDEX_H
+#define EEMS_SEEK_INDEX_H
+
+#include "../fs.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace eems
+{
+
+struct seek_point
+{
+    std::chrono::milliseconds time;
+    // Where the keyframe (or its cluster) starts in the file.
+    std::uint64_t offset;
+};
+
+struct seek_index
+{
+    std::chrono::milliseconds duration{0};
+    // Ordered by time, at most one per second.
+    std::vector<seek_point> points;
+};
+
+// Reads keyframe positions of a video from Matroska Cues or MP4 sample tables (stss/stco),
+// without touching the media data. Returns an empty index for other formats or when there is none.
+auto read_seek_index(fs::path const& path, std::u8string_view mime_type)
+    -> seek_index;
+
+}
+
+#endif
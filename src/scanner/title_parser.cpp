@@ -0,0 +1,247 @@
+#include "title_parser.h"
+
+#include "../spirit.h"
+
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <vector>
+
+namespace eems
+{
+
+namespace
+{
+enum class tag_kind
+{
+    resolution,
+    source,
+    video_codec,
+    audio_codec,
+    other,
+};
+
+// NOTE: Keys must be lower case for no_case[] to work.
+struct release_tags : x3::symbols<tag_kind>
+{
+    release_tags()
+    {
+        add                                   //
+            ("480p", tag_kind::resolution)    //
+            ("576p", tag_kind::resolution)    //
+            ("720p", tag_kind::resolution)    //
+            ("1080i", tag_kind::resolution)   //
+            ("1080p", tag_kind::resolution)   //
+            ("2160p", tag_kind::resolution)   //
+            ("4k", tag_kind::resolution)      //
+            ("bluray", tag_kind::source)      //
+            ("blu-ray", tag_kind::source)     //
+            ("bdrip", tag_kind::source)       //
+            ("brrip", tag_kind::source)       //
+            ("bdremux", tag_kind::source)     //
+            ("remux", tag_kind::source)       //
+            ("web-dl", tag_kind::source)      //
+            ("webdl", tag_kind::source)       //
+            ("webrip", tag_kind::source)      //
+            ("hdtv", tag_kind::source)        //
+            ("hdrip", tag_kind::source)       //
+            ("dvdrip", tag_kind::source)      //
+            ("dvdscr", tag_kind::source)      //
+            ("x264", tag_kind::video_codec)   //
+            ("x265", tag_kind::video_codec)   //
+            ("h264", tag_kind::video_codec)   //
+            ("h265", tag_kind::video_codec)   //
+            ("hevc", tag_kind::video_codec)   //
+            ("avc", tag_kind::video_codec)    //
+            ("xvid", tag_kind::video_codec)   //
+            ("divx", tag_kind::video_codec)   //
+            ("av1", tag_kind::video_codec)    //
+            ("aac", tag_kind::audio_codec)    //
+            ("ac3", tag_kind::audio_codec)    //
+            ("eac3", tag_kind::audio_codec)   //
+            ("dts", tag_kind::audio_codec)    //
+            ("dts-hd", tag_kind::audio_codec) //
+            ("truehd", tag_kind::audio_codec) //
+            ("atmos", tag_kind::audio_codec)  //
+            ("flac", tag_kind::audio_codec)   //
+            ("mp3", tag_kind::audio_codec)    //
+            ("10bit", tag_kind::other)        //
+            ("hdr", tag_kind::other)          //
+            ("hdr10", tag_kind::other)        //
+            ("proper", tag_kind::other)       //
+            ("repack", tag_kind::other)       //
+            ("remastered", tag_kind::other)   //
+            ("unrated", tag_kind::other)      //
+            ;
+    }
+};
+
+// Decodes the code point at the beginning of the text.
+// Returns it with its length; invalid sequences are consumed byte by byte.
+auto next_code_point(std::string_view text) -> std::pair<char32_t, std::size_t>
+{
+    auto const lead = static_cast<unsigned char>(text[0]);
+    auto const length = lead < 0x80 ? 1u : (lead >> 5) == 0x6 ? 2u
+                                       : (lead >> 4) == 0xe   ? 3u
+                                       : (lead >> 3) == 0x1e  ? 4u
+                                                              : 0u;
+    if (length == 1 || length == 0 || length > text.size())
+        return {lead, 1};
+
+    char32_t cp = lead & (0x7f >> length);
+    for (std::size_t i = 1; i < length; ++i)
+    {
+        auto const cont = static_cast<unsigned char>(text[i]);
+        if ((cont & 0xc0) != 0x80)
+            return {lead, 1};
+        cp = (cp << 6) | (cont & 0x3f);
+    }
+    return {cp, length};
+}
+
+inline auto is_separator(char32_t cp) -> bool
+{
+    switch (cp)
+    {
+    case '.':
+    case '_':
+    case ' ':
+    case '\t':
+    case '(':
+    case ')':
+    case '[':
+    case ']':
+    case '{':
+    case '}':
+    case ',':
+    case U'\u00a0': // No-break space
+    case U'\u3000': // Ideographic space
+    case U'\u3001': // Ideographic comma
+    case U'\u3010': // Black lenticular brackets
+    case U'\u3011':
+    case U'\uff08': // Fullwidth parentheses
+    case U'\uff09':
+        return true;
+    }
+    return false;
+}
+
+inline auto parse_year(std::string_view token) -> std::optional<int>
+{
+    int year = 0;
+    if (!parse(token, x3::uint_parser<int, 10, 4, 4>{}, year) || year < 1880 || year > 2099)
+        return std::nullopt;
+    return year;
+}
+
+// Returns the kind of the tag and the tag itself.
+inline auto classify_token(std::string_view token) -> std::optional<std::tuple<tag_kind, std::string_view>>
+{
+    static release_tags const tags{};
+
+    tag_kind kind;
+    if (parse(token, x3::no_case[tags], kind))
+        return std::tuple{kind, token};
+    // Release group is often glued to the last tag: x264-GROUP
+    if (auto const dash = token.rfind('-'); dash != token.npos)
+    {
+        token = token.substr(0, dash);
+        if (parse(token, x3::no_case[tags], kind))
+            return std::tuple{kind, token};
+    }
+    return std::nullopt;
+}
+
+// Tokens like "-" are not a part of the title when they end up at its end.
+inline auto is_word(std::string_view token) -> bool
+{
+    return std::any_of(token.begin(), token.end(), [](char c)
+                       { return static_cast<unsigned char>(c) >= 0x80 || std::isalnum(static_cast<unsigned char>(c)); });
+}
+
+}
+
+auto parse_release_name(std::u8string_view name) -> release_info
+{
+    auto text = std::string_view{reinterpret_cast<char const*>(name.data()), name.size()};
+
+    release_info result{};
+    std::vector<std::string_view> tokens;
+    auto year_index = std::string_view::npos;
+    auto tags_index = std::string_view::npos;
+
+    auto const add_token = [&](std::string_view token)
+    {
+        auto const index = tokens.size();
+        tokens.push_back(token);
+        // A year can be the title itself (e.g. "2012"), so it's never the first token.
+        // The last one before tags wins: "Blade Runner 2049 2017".
+        if (index > 0 && (tags_index == token.npos || !result.year))
+        {
+            if (auto year = parse_year(token); year)
+            {
+                result.year = *year;
+                year_index = index;
+                return;
+            }
+        }
+        if (index == 0)
+            return;
+        auto const tag = classify_token(token);
+        if (!tag)
+            return;
+
+        tags_index = std::min(tags_index, index);
+        auto const [kind, tag_text] = *tag;
+        std::string* field = nullptr;
+        switch (kind)
+        {
+        case tag_kind::resolution:
+            field = &result.resolution;
+            break;
+        case tag_kind::source:
+            field = &result.source;
+            break;
+        case tag_kind::video_codec:
+            field = &result.video_codec;
+            break;
+        case tag_kind::audio_codec:
+            field = &result.audio_codec;
+            break;
+        case tag_kind::other:
+            break;
+        }
+        if (field && field->empty())
+            *field = tag_text;
+    };
+
+    std::size_t token_start = 0;
+    for (std::size_t pos = 0; pos < text.size();)
+    {
+        auto const [cp, length] = next_code_point(text.substr(pos));
+        // Keep dots of abbreviations in natural names: "Mr. Nobody".
+        if (is_separator(cp) && !(cp == '.' && (pos + 1 == text.size() || text[pos + 1] == ' ')))
+        {
+            if (pos > token_start)
+                add_token(text.substr(token_start, pos - token_start));
+            token_start = pos + length;
+        }
+        pos += length;
+    }
+    if (text.size() > token_start)
+        add_token(text.substr(token_start));
+
+    auto title_end = std::min({year_index, tags_index, tokens.size()});
+    while (title_end > 0 && !is_word(tokens[title_end - 1]))
+        --title_end;
+
+    for (std::size_t i = 0; i < title_end; ++i)
+    {
+        if (i)
+            result.title += ' ';
+        result.title += tokens[i];
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,26 @@
+#ifndef EEMS_TITLE_PARSER_H
+#define EEMS_TITLE_PARSER_H
+
+#include <string>
+#include <string_view>
+
+namespace eems
+{
+
+// What can be extracted from a release (file or folder) name,
+// e.g. "The.Movie.2010.1080p.BluRay.x264-GROUP".
+struct release_info
+{
+    std::string title;
+    int year{0};
+    std::string resolution;
+    std::string source;
+    std::string video_codec;
+    std::string audio_codec;
+};
+
+auto parse_release_name(std::u8string_view name) -> release_info;
+
+}
+
+#endif
@@ -1,38 +1,133 @@
 #include "server.h"
 
+#include "allocation_stats.h"
 #include "as_result.h"
-#include "fs.h"
 #include "http_messages.h"
 #include "http_serialize.h"
-#include "ranges.h"
+#include "socket_tuning.h"
 #include "upnp.h"
 
+#include <algorithm>
+#include <array>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
 #include <fmt/ostream.h>
 #include <fmt/ranges.h>
-#include <fmt/std.h>
-#include <range/v3/algorithm/find_if_not.hpp>
-#include <range/v3/begin_end.hpp>
-#include <range/v3/iterator.hpp>
+#include <memory_resource>
+#include <optional>
 #include <spdlog/spdlog.h>
 
 namespace eems
 {
 
-auto parse_target(std::string_view target) -> std::pair<fs::path, std::string_view>
+namespace
 {
+using reuse_port = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
 
-    if (auto const query_pos = target.find('?'); query_pos != target.npos)
+// The beginning of a request read on an idle connection, the rest is read with the header.
+constexpr std::size_t idle_read_size = 1024;
+// How long answering a rejected connection may take, it isn't counted against the limits meanwhile.
+constexpr auto reject_timeout = std::chrono::seconds(1);
+
+// Splits "/service/rest?query" into the service and the rest of the path, both views into the target.
+auto route_target(std::string_view target) -> std::pair<std::string_view, std::string_view>
+{
+    target = target.substr(0, target.find('?'));
+    auto const trim = [](std::string_view path) { return path.substr(std::min(path.find_first_not_of('/'), path.size())); };
+    target = trim(target);
+    auto const slash = target.find('/');
+    if (slash == target.npos)
+        return {target, {}};
+    return {target.substr(0, slash), trim(target.substr(slash))};
+}
+
+constexpr auto as_string(transfer_priority priority) -> std::string_view
+{
+    switch (priority)
     {
-        auto const path = target.substr(0, query_pos);
-        target.remove_prefix(query_pos);
-        return {{path, fs::path::format::generic_format}, target};
+    case transfer_priority::real_time:
+        return "real_time";
+    case transfer_priority::bulk:
+        return "bulk";
     }
-    return {{target, fs::path::format::generic_format}, {}};
+    return {};
+}
+
+auto make_stats_response(std::vector<bandwidth_scheduler::transfer_stats> const& transfers,
+                         admission_control::admission_stats const& admission, http_request const& req)
+    -> http::response<http::string_body>
+{
+    auto const allocations = get_allocation_stats();
+    std::string body = fmt::format(R"({{"requests":{},"frames":{},"heap_frames":{},)", allocations.requests,
+                                   allocations.frames, allocations.heap_frames);
+    fmt::format_to(std::back_inserter(body),
+                   R"("connections":{},"rejected_connections":{},"queued_connections":{},"soap_requests":{},"rejected_soap_requests":{},)",
+                   admission.connections, admission.rejected_connections, admission.queued_connections,
+                   admission.soap_requests, admission.rejected_soap_requests);
+    if (allocations.allocations)
+        fmt::format_to(std::back_inserter(body), R"("allocations":{},)", *allocations.allocations);
+    body += "\"transfers\":[";
+    for (auto const& transfer : transfers)
+    {
+        if (body.back() != '[')
+            body += ',';
+        fmt::format_to(std::back_inserter(body),
+                       R"({{"client":"{}","resource":{},"priority":"{}","bytes_sent":{},"bitrate":{},"duration":{}}})",
+                       transfer.client, transfer.resource, as_string(transfer.priority), transfer.bytes_sent,
+                       transfer.bitrate, transfer.duration.count());
+    }
+    body += "]}";
+
+    http::response<http::string_body> res{http::status::ok, req.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "application/json");
+    res.keep_alive(req.keep_alive());
+    res.body() = std::move(body);
+    res.prepare_payload();
+    return res;
+}
+
+// Answers requests over the limits, the client is to try again later.
+auto make_unavailable_response(http_request const& req, std::chrono::seconds retry_after) -> error_response_ptr
+{
+    auto res = make_error_response(http::status::service_unavailable, "Service Unavailable", req);
+    res->set(http::field::retry_after, std::to_string(retry_after.count()));
+    return res;
+}
+
+// Answers a connection over the client's limit at once, without waiting for its request, and closes it.
+auto reject_connection(tcp_stream& stream, std::chrono::seconds retry_after) -> net::awaitable<void>
+{
+    auto res = http::response<http::empty_body>{http::status::service_unavailable, 11};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::retry_after, std::to_string(retry_after.count()));
+    res.keep_alive(false);
+    res.prepare_payload();
+
+    stream.expires_after(reject_timeout);
+    if (auto const written = co_await http::async_write(stream, res); !written)
+    {
+        spdlog::debug("Rejecting connection failed: {}", written.error().message());
+        co_return;
+    }
+    // Closing with the request unread would reset the connection, which may discard the answer before the client
+    // reads it. So whatever arrives is dropped unparsed until the client closes too, or the deadline passes.
+    beast::error_code ec;
+    stream.socket().shutdown(net::socket_base::shutdown_send, ec);
+    auto discarded = std::array<char, 512>{};
+    while (co_await stream.async_read_some(net::buffer(discarded)))
+    {
+    }
+}
+}
+
+server::~server()
+{
+    admission_.remove_acceptor(released_);
 }
 
 auto server::handle_connections(net::ip::tcp::socket socket) -> net::awaitable<void>
@@ -40,75 +135,129 @@ auto server::handle_connections(net::ip::tcp::socket socket) -> net::awaitable<v
     try
     {
         auto stream = tcp_stream{std::move(socket)};
+        beast::error_code endpoint_ec;
+        auto const admitted = admission_.admit_connection(stream.socket().remote_endpoint(endpoint_ec).address());
+        if (!admitted)
+        {
+            co_await reject_connection(stream, config_.retry_after);
+            co_return;
+        }
 
+        // The request and its buffers are reused for every request of the connection, so that once they have grown
+        // to the size of the usual request, routing one doesn't touch the heap.
         auto buffer = beast::flat_buffer{};
-        for (;;)
+        auto pool = std::pmr::unsynchronized_pool_resource{};
+        auto req = http_request{std::piecewise_construct, std::make_tuple(), std::make_tuple(pool_allocator<char>{&pool})};
+        // The socket is tuned for the traffic of the request, which is usually the same for the whole connection.
+        auto traffic = std::optional<traffic_class>{};
+        auto const tune = [&](traffic_class requested)
+        {
+            if (traffic != requested)
+            {
+                tune_socket(stream.socket(), requested, config_);
+                traffic = requested;
+            }
+        };
+        for (auto first = true;; first = false)
         {
-            auto req = http_request{};
-            stream.expires_after(std::chrono::seconds(30));
-            auto rc = co_await http::async_read(stream, buffer, req, as_result(net::use_awaitable)); // TODO: use_async_result
+            req.clear();
+            req.body().clear();
+            if (!first && !buffer.size())
+            {
+                // Waiting for the next request, which (once it starts) gets the header timeout.
+                stream.expires_after(config_.keep_alive_timeout);
+                auto const rc = co_await stream.async_read_some(buffer.prepare(idle_read_size));
+                if (!rc)
+                {
+                    spdlog::debug("Idle connection closed: {}", fmt::streamed(rc.error()));
+                    break;
+                }
+                buffer.commit(rc.value());
+            }
+            stream.expires_after(config_.header_timeout);
+            auto rc = co_await http::async_read(stream, buffer, req);
             if (!rc)
             {
                 spdlog::debug("Read failed: {}", fmt::streamed(rc.error()));
                 break;
             }
+            // Handlers renew the deadline before each part of a long response.
+            stream.expires_after(config_.write_timeout);
 
+            count_request();
             spdlog::debug("Got request: {} {}", req.method_string(), req.target());
 
-            auto [path, query] = parse_target(req.target());
-
-            auto begin = ranges::find_if_not(path, &fs::path::has_root_directory);
-
-            if (begin == ranges::end(path))
+            auto const [service, sub_path] = route_target(req.target());
+            if (service.empty())
             {
                 // Serve index.
-                co_await http::async_write(stream, *make_error_response(http::status::ok, "<html><body>Welcome!</body></html>", req));
+                if (!co_await http::async_write(stream, *make_error_response(http::status::ok, "<html><body>Welcome!</body></html>", req)))
+                    break;
                 continue;
             }
 
-            spdlog::debug("Shall dispatch: {}", *begin);
-            auto sub_path = fs::path{};
-            for (auto it = ranges::next(begin); it != ranges::end(path); ++it)
+            spdlog::debug("Shall dispatch: {}", service);
+            // Handlers fail with the error to answer, or with the one which broke the connection.
+            auto handled = io_result<bool>{true};
+            if (service == "upnp")
             {
-                sub_path /= *it;
-            }
-            // If we need to send an error back because of exception, store it separately,
-            // because coroutine can't be suspended in catch() caluse (due to the active exception).
-            error_response_ptr exceptional_error;
-            try
-            {
-                if (begin->native() == "upnp")
-                {
-                    co_await upnp_service_.handle_upnp_request(stream, std::move(req), std::move(sub_path));
-                    continue;
-                }
-                else if (begin->native() == "content")
+                tune(traffic_class::control);
+                // Descriptions are static, only SOAP actions (which read the store) are limited.
+                auto const is_soap = req.method() == http::verb::post;
+                auto const soap_request = is_soap ? admission_.admit_soap_request() : admission_control::ticket{};
+                if (is_soap && !soap_request)
                 {
-                    bool const server_more = co_await content_service_.handle_request(stream, std::move(req), std::move(sub_path));
-                    if (server_more)
-                        continue;
-                    else
-                        break;
+                    handled = make_http_error(http::status::service_unavailable);
                 }
-                else
+                else if (auto rc = co_await upnp_service_.handle_upnp_request(stream, req, sub_path); !rc)
                 {
-                    spdlog::debug("Not found: {}", *begin);
-                    exceptional_error = make_error_response(http::status::not_found, "Not found", req);
+                    handled = rc.error();
                 }
             }
-            catch (http_error const& e)
+            else if (service == "stats")
             {
-                exceptional_error = make_error_response(e.status, e.what(), req);
+                if (auto rc = co_await http::async_write(stream, make_stats_response(content_service_.active_transfers(), admission_.stats(), req)); !rc)
+                    handled = rc.error();
             }
-            catch (upnp_error const& e)
+            else if (service == "content")
             {
-                exceptional_error = make_upnp_error_response(e, req);
+                tune(traffic_class::bulk);
+                handled = co_await content_service_.handle_request(stream, req, sub_path);
+            }
+            else
+            {
+                spdlog::debug("Not found: {}", service);
+                handled = make_http_error(http::status::not_found);
+            }
+
+            if (handled)
+            {
+                if (handled.value())
+                    continue;
+                break;
             }
 
-            if (exceptional_error)
+            error_response_ptr response;
+            if (auto const& ec = handled.error(); ec == make_http_error(http::status::service_unavailable))
             {
-                co_await http::async_write(stream, *exceptional_error);
+                response = make_unavailable_response(req, config_.retry_after);
             }
+            else if (ec.category() == http_category())
+            {
+                response = make_error_response(static_cast<http::status>(ec.value()), ec.message(), req);
+            }
+            else if (ec.category() == upnp_category())
+            {
+                response = make_upnp_error_response(ec, req);
+            }
+            else
+            {
+                spdlog::debug("Connection failed: {}", ec.message());
+                break;
+            }
+            stream.expires_after(config_.write_timeout);
+            if (!co_await http::async_write(stream, *response))
+                break;
         }
     }
     catch (boost::system::system_error& e)
@@ -125,25 +274,41 @@ auto server::handle_connections(net::ip::tcp::socket socket) -> net::awaitable<v
     }
 }
 
-auto server::run_server() -> net::awaitable<void>
+auto server::listen() -> void
 {
-    auto executor = co_await net::this_coro::executor;
-    auto acceptor = net::ip::tcp::acceptor{executor, {net::ip::tcp::v4(), config_.listen_port}};
-
-    // TODO: Updating config here may be not safe in the future,
-    // so this should be split up into intiialization and run.
-    // however now it's single-threaded so other services won' access it.
+    auto const endpoint = net::ip::tcp::endpoint{net::ip::tcp::v4(), config_.listen_port};
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(net::socket_base::reuse_address(true));
+    if (config_.sharded)
     {
-        config_.listen_port = acceptor.local_endpoint().port();
-        config_.base_url = fmt::format("http://{}:{}", config_.host_name, config_.listen_port);
+        // The kernel spreads connections between the sockets bound to the port.
+        acceptor_.set_option(reuse_port(true));
     }
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+
+    config_.listen_port = acceptor_.local_endpoint().port();
+    config_.base_url = fmt::format("http://{}:{}", config_.host_name, config_.listen_port);
 
     spdlog::info("Server listening on {}", config_.base_url);
+}
 
+auto server::run_server() -> net::awaitable<void>
+{
     for (;;)
     {
-        auto socket = co_await acceptor.async_accept(net::use_awaitable);
-        net::co_spawn(executor, handle_connections(std::move(socket)), net::detached);
+        // New connections wait in the backlog until one of the served ones closes.
+        if (admission_.is_full())
+        {
+            admission_.count_queued();
+            while (admission_.is_full())
+                co_await released_.async_receive(net::use_awaitable);
+        }
+
+        // Handlers of a connection never run concurrently, while connections are served in parallel.
+        auto strand = net::make_strand(acceptor_.get_executor());
+        auto socket = co_await acceptor_.async_accept(strand, net::use_awaitable);
+        net::co_spawn(strand, handle_connections(std::move(socket)), net::detached);
     }
 }
 }
@@ -1,26 +1,50 @@
 #ifndef EEMS_SERVER_H
 #define EEMS_SERVER_H
 
+#include "admission_control.h"
 #include "content_service.h"
+#include "frame_pool.h"
 #include "net.h"
 #include "upnp.h"
 
 #include <boost/asio/awaitable.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
 
 namespace eems
 {
+// The frame of a closed connection is reused by the next one.
+class server;
+template <>
+inline constexpr bool pooled_frames<server> = true;
+
 class server
 {
 public:
-    explicit server(server_config& config,
+    explicit server(net::io_context& io_context,
+                    server_config& config,
+                    admission_control& admission,
                     upnp_service& upnp_service,
                     content_service& content_service)
         : config_{config},
+          admission_{admission},
           upnp_service_{upnp_service},
-          content_service_{content_service}
+          content_service_{content_service},
+          acceptor_{io_context},
+          released_{io_context, 1}
     {
+        admission_.add_acceptor(released_);
     }
+    server(server const&) = delete;
+    auto operator=(server const&) -> server& = delete;
+    ~server();
+
+    // Binds the listening socket and completes the config with its address,
+    // must be called before anything which uses the config is started.
+    // Sharded servers bind the same port, the first one picks it when it's not configured.
+    auto listen() -> void;
 
+    // Accepts connections, each of them is handled on its own strand. Waits while all connections are taken.
     auto run_server() -> net::awaitable<void>;
 
 private:
@@ -28,8 +52,12 @@ private:
 
 private:
     server_config& config_;
+    admission_control& admission_;
     upnp_service& upnp_service_;
     content_service& content_service_;
+    net::ip::tcp::acceptor acceptor_;
+    // Wakes up accepting when it waits for a connection to close.
+    admission_control::release_channel released_;
 };
 }
 
@@ -2,6 +2,8 @@
 #define EEMS_SERVER_CONFIG_H
 
 #include <boost/uuid/uuid.hpp>
+#include <chrono>
+#include <cstdint>
 #include <string>
 
 namespace eems
@@ -14,6 +16,42 @@ struct server_config
     std::string host_name;
     std::string name;
     std::string base_url;
+    // Send files with sendfile(2), without copying them through user space. Data which isn't in the page cache
+    // is read on the I/O pool first, so the event loop never waits for the drive.
+    bool zero_copy{true};
+    // Read files asynchronously with io_uring, when built with it. Takes precedence over zero_copy.
+    bool io_uring{true};
+    // Upload limits in bytes per second, 0 for unlimited.
+    std::uint64_t client_rate_limit{0};
+    std::uint64_t total_rate_limit{0};
+    // Threads running the event loop, 0 for one per CPU core.
+    std::size_t threads{0};
+    // Threads doing blocking file operations (opening, waking up drives, reading), shared by all shards.
+    std::size_t io_threads{4};
+    // Each thread runs its own event loop, with its own listening socket (SO_REUSEPORT) and caches,
+    // so connections stay on the thread which accepted them.
+    bool sharded{false};
+    // A request must arrive whole within this time of its first byte (of the connection for the first request),
+    // so clients trickling their headers are dropped.
+    std::chrono::seconds header_timeout{10};
+    // How long a connection may stay idle between requests.
+    std::chrono::seconds keep_alive_timeout{30};
+    // Each write must complete within this time, a stream renews it with every chunk, so it's never cut short
+    // while the client keeps reading.
+    std::chrono::seconds write_timeout{30};
+    // Connections served at the same time, 0 for unlimited. When they're all taken, new ones wait in the backlog.
+    std::size_t max_connections{1024};
+    // Connections of a single client and SOAP requests handled at the same time, further ones get 503.
+    std::size_t max_client_connections{32};
+    std::size_t max_soap_requests{64};
+    // Retry-After of the 503 answers.
+    std::chrono::seconds retry_after{5};
+    // Send buffer of streaming connections in bytes, 0 leaves it to the kernel's autotuning. A fixed size
+    // disables autotuning and is capped by net.core.wmem_max.
+    std::size_t stream_send_buffer{0};
+    // Unsent bytes a streaming connection queues (TCP_NOTSENT_LOWAT), 0 for no limit. A shallow queue
+    // makes seeking faster, at the cost of more wakeups.
+    std::size_t stream_notsent_lowat{0};
 };
 
 }
@@ -24,41 +24,44 @@ auto local_name(pugi::xml_node const& node)
     return fqname;
 }
 
-auto parse_soap_request(http_request& req) -> soap_action_info
+auto parse_soap_request(http_request& req, soap_action_info& soap_info) -> io_result<>
 {
     using namespace x3;
 
     if (req.method() != http::verb::post)
     {
-        throw http_error{http::status::bad_request, "Unsupported HTTP-method"};
+        spdlog::debug("Unsupported HTTP-method: {}", req.method_string());
+        return make_http_error(http::status::bad_request);
     }
 
     // TODO: Optional parmeters may need to be parsed, like encoding.
     if (!req[http::field::content_type].starts_with("text/xml"))
     {
-        throw http_error{http::status::unsupported_media_type, "Must be an XML"};
+        return make_http_error(http::status::unsupported_media_type);
     }
 
-    auto soap_info = soap_action_info{};
     if (!parse(req["soapaction"],
                ('"' >> +(char_ - '#') >> '#' >> +(char_ - '"') >> '"'),
                soap_info))
     {
-        throw http_error{http::status::bad_request, "Invalid SOAPACTION header"};
+        spdlog::debug("Invalid SOAPACTION header: {}", req["soapaction"]);
+        return make_http_error(http::status::bad_request);
     }
 
     auto buffer = req.body().data();
 
     if (auto parse_result = soap_info.doc.load_buffer_inplace(buffer.data(), buffer.size()); !parse_result)
     {
-        throw http_error{http::status::bad_request, parse_result.description()};
+        spdlog::debug("Invalid SOAP request: {}", parse_result.description());
+        return make_http_error(http::status::bad_request);
     }
 
     soap_info.params = soap_info.doc.document_element().first_child().first_child();
     if (local_name(soap_info.params) != soap_info.action)
     {
-        throw http_error{http::status::bad_request, "Invalid action element"};
+        spdlog::debug("Invalid action element: {}", soap_info.params.name());
+        return make_http_error(http::status::bad_request);
     }
-    return soap_info;
+    return success();
 }
 }
@@ -15,6 +15,7 @@ struct soap_action_info
     pugi::xml_node params;
 };
 
-auto parse_soap_request(http_request& req) -> soap_action_info;
+// Parsed params point into the document, so the info is filled in place rather than returned.
+auto parse_soap_request(http_request& req, soap_action_info& soap_info) -> io_result<>;
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "socket_tuning.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <spdlog/spdlog.h>
+
+namespace eems
+{
+
+namespace
+{
+#ifdef __linux__
+using tcp_cork = net::detail::socket_option::boolean<IPPROTO_TCP, TCP_CORK>;
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+using tcp_notsent_lowat = net::detail::socket_option::integer<IPPROTO_TCP, TCP_NOTSENT_LOWAT>;
+#endif
+
+// Tuning is best effort, the connection works without it.
+template <typename Option>
+auto set_option(net::ip::tcp::socket& socket, Option const& option, char const* name) -> void
+{
+    boost::system::error_code ec;
+    socket.set_option(option, ec);
+    if (ec && socket.is_open())
+    {
+        spdlog::debug("Can't set {}: {}", name, ec.message());
+    }
+}
+}
+
+auto tune_socket(net::ip::tcp::socket& socket, traffic_class traffic, server_config const& config) -> void
+{
+    switch (traffic)
+    {
+    case traffic_class::control:
+        set_option(socket, net::ip::tcp::no_delay{true}, "TCP_NODELAY");
+        break;
+    case traffic_class::bulk:
+        if (config.stream_send_buffer)
+        {
+            set_option(socket, net::socket_base::send_buffer_size{static_cast<int>(config.stream_send_buffer)}, "SO_SNDBUF");
+        }
+#ifdef TCP_NOTSENT_LOWAT
+        if (config.stream_notsent_lowat)
+        {
+            set_option(socket, tcp_notsent_lowat{static_cast<int>(config.stream_notsent_lowat)}, "TCP_NOTSENT_LOWAT");
+        }
+#endif
+        break;
+    }
+}
+
+socket_cork::socket_cork(net::ip::tcp::socket& socket)
+    : socket_{socket}
+{
+#ifdef __linux__
+    set_option(socket_, tcp_cork{true}, "TCP_CORK");
+#endif
+}
+
+socket_cork::~socket_cork()
+{
+#ifdef __linux__
+    // Sends what's left right away.
+    set_option(socket_, tcp_cork{false}, "TCP_CORK");
+#endif
+}
+
+}
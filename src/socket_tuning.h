@@ -0,0 +1,40 @@
+#ifndef EEMS_SOCKET_TUNING_H
+#define EEMS_SOCKET_TUNING_H
+
+#include "net.h"
+#include "server_config.h"
+
+#include <boost/asio/ip/tcp.hpp>
+
+namespace eems
+{
+
+enum class traffic_class
+{
+    // SOAP and descriptions: small responses, which should leave at once.
+    control,
+    // Streams of content, which should keep the link busy.
+    bulk,
+};
+
+// Control responses aren't delayed by Nagle (TCP_NODELAY). Bulk ones get the configured send buffer and
+// optionally a shallow queue of unsent data (TCP_NOTSENT_LOWAT), so a seek doesn't wait for stale data.
+auto tune_socket(net::ip::tcp::socket& socket, traffic_class traffic, server_config const& config) -> void;
+
+// Holds partial frames while it's alive (TCP_CORK), so a response header leaves in the same packet
+// as the beginning of the body.
+class socket_cork
+{
+public:
+    explicit socket_cork(net::ip::tcp::socket& socket);
+    socket_cork(socket_cork const&) = delete;
+    auto operator=(socket_cork const&) -> socket_cork& = delete;
+    ~socket_cork();
+
+private:
+    net::ip::tcp::socket& socket_;
+};
+
+}
+
+#endif
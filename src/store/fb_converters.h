@@ -3,6 +3,7 @@
 
 #include "schema_generated.h"
 
+#include <span>
 #include <string>
 
 namespace eems
@@ -11,7 +12,9 @@ namespace eems
 template <typename TKey>
 auto serialize_key(TKey const& key) -> std::string
 {
-    auto fbb = flatbuffers::FlatBufferBuilder{};
+    // Keys are serialized for every lookup, so keep the builder's buffer around.
+    thread_local auto fbb = flatbuffers::FlatBufferBuilder{64};
+    fbb.Clear();
     auto key_buffer = CreateLibraryKey(fbb, KeyUnionTraits<TKey>::enum_value, fbb.CreateStruct(key).Union());
     fbb.Finish(key_buffer);
     return std::string{reinterpret_cast<char const*>(fbb.GetBufferPointer()), fbb.GetSize()};
@@ -68,24 +71,31 @@ inline auto as_library_key(flatbuffers::Vector<uint8_t> const& raw) -> std::stri
     return std::string{reinterpret_cast<char const*>(raw.data()), raw.size()};
 }
 
-template <typename T>
-inline auto put_vector(flatbuffers::FlatBufferBuilder& fbb, std::vector<flatbuffers::Offset<T>> const& src)
+template <typename T, typename Alloc>
+inline auto put_vector(flatbuffers::FlatBufferBuilder& fbb, std::vector<flatbuffers::Offset<T>, Alloc> const& src)
     -> flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<T>>>
 {
     if (src.empty())
         return {};
     else
-        return fbb.CreateVector(src);
+        return fbb.CreateVector(src.data(), src.size());
 }
 
-template <typename T>
-inline auto put_sorted_vector(flatbuffers::FlatBufferBuilder& fbb, std::vector<flatbuffers::Offset<T>>&& src)
+template <typename T, typename Alloc>
+inline auto put_sorted_vector(flatbuffers::FlatBufferBuilder& fbb, std::vector<flatbuffers::Offset<T>, Alloc>&& src)
     -> flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<T>>>
 {
     if (src.empty())
         return {};
     else
-        return fbb.CreateVectorOfSortedTables(&src);
+        return fbb.CreateVectorOfSortedTables(src.data(), src.size());
+}
+
+// View of the finished buffer, valid until the builder is cleared or destroyed.
+inline auto finished_buffer(flatbuffers::FlatBufferBuilder const& fbb)
+    -> std::span<uint8_t const>
+{
+    return {fbb.GetBufferPointer(), fbb.GetSize()};
 }
 
 }
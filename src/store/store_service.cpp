@@ -1,8 +1,10 @@
 #include "store_service.h"
 
 #include "../ranges.h"
+#include "../run_on.h"
 #include "fb_converters.h"
 
+#include <algorithm>
 #include <leveldb/write_batch.h>
 #include <range/v3/action/push_back.hpp>
 #include <range/v3/algorithm/find.hpp>
@@ -15,6 +17,23 @@ namespace eems
 
 namespace
 {
+inline auto as_slice(buffer_view buf) -> leveldb::Slice
+{
+    return {reinterpret_cast<char const*>(buf.data()), buf.size()};
+}
+
+auto as_artwork_meta(Artwork const& artwork) -> artwork_meta
+{
+    artwork_meta result{.key{as_library_key(*artwork.ref())}, .type{artwork.type()}};
+    if (auto variants = artwork.variants(); variants)
+    {
+        ranges::push_back(result.variants,
+                          views::transform(*variants, [](ArtworkVariant const* variant)
+                                           { return std::tuple{as_library_key(*variant->ref()), variant->profile()}; }));
+    }
+    return result;
+}
+
 inline auto ordering_to_int(std::strong_ordering v) -> int
 {
     if (v < 0)
@@ -38,6 +57,11 @@ inline auto operator<=>(ResourceKey const& lhs, ResourceKey const& rhs)
     return lhs.id() <=> rhs.id();
 }
 
+inline auto operator<=>(ScanJournalKey const& lhs, ScanJournalKey const& rhs)
+{
+    return lhs.library() <=> rhs.library();
+}
+
 int store_service::fb_comparator::Compare(leveldb::Slice const& lhs_s, leveldb::Slice const& rhs_s) const
 {
     auto const lhs = flatbuffers::GetRoot<LibraryKey>(lhs_s.data());
@@ -54,6 +78,8 @@ int store_service::fb_comparator::Compare(leveldb::Slice const& lhs_s, leveldb::
             return *lhs->key_as<ObjectKey>() <=> *rhs->key_as<ObjectKey>();
         case KeyUnion::ResourceKey:
             return *lhs->key_as<ResourceKey>() <=> *rhs->key_as<ResourceKey>();
+        case KeyUnion::ScanJournalKey:
+            return *lhs->key_as<ScanJournalKey>() <=> *rhs->key_as<ScanJournalKey>();
         case KeyUnion::NONE:
             spdlog::error("Unexpected key type: {}", fmt::underlying(lhs->key_type()));
         }
@@ -65,6 +91,8 @@ int store_service::fb_comparator::Compare(leveldb::Slice const& lhs_s, leveldb::
 auto store_service::open_db(store_config const& config)
     -> bool
 {
+    read_pool_ = std::make_unique<net::thread_pool>(std::max<std::size_t>(1, config.read_threads));
+
     leveldb::DB* db = nullptr;
     leveldb::Options options{};
     options.comparator = &comparator_;
@@ -99,10 +127,10 @@ auto store_service::open_db(store_config const& config)
         .id{0},
         .parent_id{-1},
         .upnp_class{upnp_container_class}};
-    auto container_buf = serialize_container({}, root_container);
+    flatbuffers::FlatBufferBuilder fbb{};
     status = db_->Put(leveldb::WriteOptions{},
                       serialize_key(ObjectKey{0}),
-                      leveldb::Slice{reinterpret_cast<char const*>(container_buf.data()), container_buf.size()});
+                      as_slice(serialize_container(fbb, {}, root_container)));
     if (!status.ok())
     {
         throw std::runtime_error("Failed to create root container");
@@ -151,8 +179,9 @@ inline auto store_service::create_iterator() const -> std::unique_ptr<::leveldb:
 }
 
 auto store_service::put_items(ObjectKey parent,
-                              std::vector<flatbuffers::DetachedBuffer>&& items,
-                              std::vector<std::tuple<ResourceKey, flatbuffers::DetachedBuffer>>&& resources)
+                              std::span<buffer_view const> items,
+                              std::span<std::tuple<ResourceKey, buffer_view> const> resources,
+                              scan_journal const* journal)
     -> void
 {
     auto const parent_key = serialize_key(parent);
@@ -161,14 +190,12 @@ auto store_service::put_items(ObjectKey parent,
     // Process resources first because items' references to resources need to be updated.
     leveldb::WriteBatch batch{};
 
-    for (auto&& [res_key, res_buf] : resources)
+    for (auto const& [res_key, res_buf] : resources)
     {
-        batch.Put(
-            serialize_key(res_key),
-            leveldb::Slice{reinterpret_cast<char const*>(res_buf.data()), res_buf.size()});
+        batch.Put(serialize_key(res_key), as_slice(res_buf));
     }
 
-    for (auto&& item_buf : items)
+    for (auto const item_buf : items)
     {
         auto item = flatbuffers::GetRoot<MediaObject>(item_buf.data());
         spdlog::info("Adding new item with key {} (parent {}), name: {}",
@@ -178,16 +205,21 @@ auto store_service::put_items(ObjectKey parent,
             throw std::logic_error("Parent mismatch");
 
         auto key = serialize_key(*item->id());
-        batch.Put(
-            key,
-            leveldb::Slice{reinterpret_cast<char const*>(item_buf.data()), item_buf.size()});
+        batch.Put(key, as_slice(item_buf));
 
         container_data.emplace_back(std::move(key));
     }
 
-    auto container_buf = serialize_container(container_data, *container_meta);
-    batch.Put(parent_key,
-              leveldb::Slice{reinterpret_cast<char const*>(container_buf.data()), container_buf.size()});
+    // Batch copies the data, so the same builder is reused for the journal.
+    flatbuffers::FlatBufferBuilder fbb{};
+    batch.Put(parent_key, as_slice(serialize_container(fbb, container_data, *container_meta)));
+
+    // Scan progress goes into the same batch so it never gets ahead of or behind the items.
+    if (journal)
+    {
+        fbb.Clear();
+        batch.Put(serialize_key(journal->id), as_slice(serialize_scan_journal(fbb, *journal)));
+    }
 
     auto status = db_->Write(leveldb::WriteOptions{}, &batch);
     if (!status.ok())
@@ -254,6 +286,111 @@ auto store_service::get_resource(ResourceKey id)
     return result;
 }
 
+auto store_service::read_objects(std::vector<std::string> const& keys, std::uint32_t start_index, std::uint32_t count) const
+    -> object_page
+{
+    object_page result{.total_matches = keys.size()};
+    auto const first = std::min<std::size_t>(start_index, keys.size());
+    auto const last = count ? std::min<std::size_t>(first + count, keys.size()) : keys.size();
+    result.objects.reserve(last - first);
+
+    auto it = create_iterator();
+    for (auto i = first; i < last; ++i)
+    {
+        it->Seek(keys[i]);
+        if (!it->Valid() || it->key() != keys[i])
+        {
+            spdlog::error("Inconsistent directory: {}", keys[i]);
+            throw std::runtime_error("DB state is corrupted: non-existing element");
+        }
+        result.objects.emplace_back(it->value().ToString());
+    }
+    return result;
+}
+
+auto store_service::list_async(ObjectKey id, std::uint32_t start_index, std::uint32_t count)
+    -> net::awaitable<object_page>
+{
+    return run_on(*read_pool_, [this, id, start_index, count]
+                  {
+                      auto [objects, meta] = deserialize_container(serialize_key(id), *create_iterator(), false);
+                      return read_objects(objects, start_index, count);
+                  });
+}
+
+auto store_service::get_async(ObjectKey id)
+    -> net::awaitable<object_page>
+{
+    return run_on(*read_pool_, [this, id]
+                  {
+                      auto key = serialize_key(id);
+                      auto it = create_iterator();
+                      it->Seek(key);
+                      object_page result{};
+                      if (it->Valid() && it->key() == key)
+                      {
+                          result.objects.emplace_back(it->value().ToString());
+                          result.total_matches = 1;
+                      }
+                      return result;
+                  });
+}
+
+auto store_service::get_resource_async(ResourceKey id)
+    -> net::awaitable<resource_result>
+{
+    return run_on(*read_pool_, [this, id]
+                  { return get_resource(id); });
+}
+
+auto store_service::get_scan_journal(ScanJournalKey id)
+    -> std::optional<scan_journal>
+{
+    auto it = create_iterator();
+    auto const key_s = serialize_key(id);
+    it->Seek(key_s);
+    if (!it->Valid() || it->key() != key_s)
+    {
+        return std::nullopt;
+    }
+
+    auto const stored = flatbuffers::GetRoot<ScanJournal>(it->value().data());
+
+    scan_journal result{
+        .id{id},
+        .root{as_string_view<char>(*stored->root())}};
+    if (auto last_directory = stored->last_directory(); last_directory)
+    {
+        result.last_directory = as_string_view<char>(*last_directory);
+    }
+    if (auto pending = stored->pending(); pending)
+    {
+        ranges::push_back(result.pending,
+                          views::transform(*pending, [](PendingDirectory const* dir)
+                                           {
+                                               return pending_directory{
+                                                   .path{as_string_view<char>(*dir->path())},
+                                                   .parent_id{*dir->parent_id()},
+                                                   .collection_id{dir->collection_id() ? std::optional{*dir->collection_id()} : std::nullopt},
+                                                   .use_collections{dir->use_collections()}};
+                                           }));
+    }
+    return result;
+}
+
+auto store_service::put_scan_journal(scan_journal const& journal)
+    -> void
+{
+    flatbuffers::FlatBufferBuilder fbb{};
+    auto status = db_->Put(leveldb::WriteOptions{},
+                           serialize_key(journal.id),
+                           as_slice(serialize_scan_journal(fbb, journal)));
+    if (!status.ok())
+    {
+        spdlog::error("Failed to store scan journal: {}", status.ToString());
+    }
+}
+
 auto store_service::deserialize_container(std::string const& key, ::leveldb::Iterator& iter, bool include_meta)
     -> std::tuple<std::vector<std::string>, std::unique_ptr<container_meta>>
 {
@@ -284,7 +421,7 @@ auto store_service::deserialize_container(std::string const& key, ::leveldb::Ite
         {
             ranges::push_back(meta->artwork,
                               views::transform(*artwork, [](Artwork const* item)
-                                               { return std::tuple{as_library_key(*item->ref()), item->type()}; }));
+                                               { return as_artwork_meta(*item); }));
         }
     }
 
@@ -298,11 +435,23 @@ auto store_service::deserialize_container(std::string const& key, ::leveldb::Ite
     return {std::move(container_data), std::move(meta)};
 }
 
-auto serialize_container(std::vector<std::string> const& contents, container_meta const& meta)
-    -> flatbuffers::DetachedBuffer
+auto create_artwork(flatbuffers::FlatBufferBuilder& fbb, artwork_meta const& meta)
+    -> flatbuffers::Offset<Artwork>
 {
-    flatbuffers::FlatBufferBuilder fbb{};
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<ArtworkVariant>>> variants_off{};
+    if (!meta.variants.empty())
+    {
+        variants_off = fbb.CreateVector(
+            meta.variants | views::transform([&fbb](auto const& tup)
+                                             { return CreateArtworkVariant(fbb, CreateLibraryKey(fbb, std::get<0>(tup)), std::get<1>(tup)); }) |
+            ranges::to<std::vector>());
+    }
+    return CreateArtwork(fbb, CreateLibraryKey(fbb, meta.key), meta.type, variants_off);
+}
 
+auto serialize_container(flatbuffers::FlatBufferBuilder& fbb, std::vector<std::string> const& contents, container_meta const& meta)
+    -> buffer_view
+{
     auto container_off = CreateMediaContainer(
         fbb,
         fbb.CreateVector(
@@ -315,8 +464,8 @@ auto serialize_container(std::vector<std::string> const& contents, container_met
     if (!meta.artwork.empty())
     {
         artwork_off = fbb.CreateVector(
-            meta.artwork | views::transform([&fbb](auto const& tup)
-                                            { return CreateArtwork(fbb, CreateLibraryKey(fbb, std::get<0>(tup)), std::get<1>(tup)); }) |
+            meta.artwork | views::transform([&fbb](artwork_meta const& artwork)
+                                            { return create_artwork(fbb, artwork); }) |
             ranges::to<std::vector>());
     }
 
@@ -333,7 +482,42 @@ auto serialize_container(std::vector<std::string> const& contents, container_met
     builder.add_data(container_off.Union());
 
     fbb.Finish(builder.Finish());
-    return fbb.Release();
+    return finished_buffer(fbb);
+}
+
+auto serialize_scan_journal(flatbuffers::FlatBufferBuilder& fbb, scan_journal const& journal)
+    -> buffer_view
+{
+    auto pending_off = put_vector(
+        fbb,
+        journal.pending |
+            views::transform([&fbb](pending_directory const& dir)
+                             {
+                                 auto const path_off = put_string(dir.path.native(), fbb);
+                                 PendingDirectoryBuilder builder{fbb};
+                                 builder.add_path(path_off);
+                                 builder.add_parent_id(&dir.parent_id);
+                                 if (dir.collection_id)
+                                     builder.add_collection_id(&*dir.collection_id);
+                                 builder.add_use_collections(dir.use_collections);
+                                 return builder.Finish();
+                             }) |
+            ranges::to<std::vector>());
+
+    auto root_off = put_string(journal.root.native(), fbb);
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> last_directory_off{};
+    if (!journal.last_directory.empty())
+    {
+        last_directory_off = put_string(journal.last_directory.native(), fbb);
+    }
+
+    ScanJournalBuilder builder{fbb};
+    builder.add_root(root_off);
+    builder.add_pending(pending_off);
+    builder.add_last_directory(last_directory_off);
+
+    fbb.Finish(builder.Finish());
+    return finished_buffer(fbb);
 }
 
 }
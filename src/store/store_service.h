@@ -1,13 +1,20 @@
 #ifndef EEMS_STORE_SERVICE_H
 #define EEMS_STORE_SERVICE_H
 
+#include "../fs.h"
+#include "../net.h"
 #include "../ranges.h"
 #include "../store_config.h"
 #include "schema_generated.h"
 
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <leveldb/comparator.h>
 #include <leveldb/db.h>
+#include <memory>
+#include <optional>
 #include <range/v3/view/facade.hpp>
+#include <span>
 #include <string_view>
 
 namespace eems
@@ -15,18 +22,59 @@ namespace eems
 
 constexpr auto upnp_container_class{u8"object.container"};
 
+struct artwork_meta
+{
+    std::string key;
+    ArtworkType type;
+    // Downscaled copies, from the smallest one.
+    std::vector<std::tuple<std::string, ArtworkProfile>> variants;
+};
+
 struct container_meta
 {
     ObjectKey id;
     ObjectKey parent_id;
     std::u8string dc_title;
     std::u8string upnp_class;
-    std::vector<std::tuple<std::string, ArtworkType>> artwork;
+    std::vector<artwork_meta> artwork;
+};
+
+auto create_artwork(flatbuffers::FlatBufferBuilder& fbb, artwork_meta const& meta)
+    -> flatbuffers::Offset<Artwork>;
+
+// Serialized object, not owned (e.g. finished builder or an arena).
+using buffer_view = std::span<uint8_t const>;
+
+auto serialize_container(flatbuffers::FlatBufferBuilder& fbb, std::vector<std::string> const& contents, container_meta const& meta)
+    -> buffer_view;
+
+struct pending_directory
+{
+    fs::path path;
+    ObjectKey parent_id;
+    std::optional<ObjectKey> collection_id;
+    bool use_collections{true};
 };
 
-auto serialize_container(std::vector<std::string> const& contents, container_meta const& meta)
-    -> flatbuffers::DetachedBuffer;
+// Progress of a library scan: directories which are still to be scanned.
+// It is committed together with the items of each scanned directory,
+// so after a crash the scan continues from the last committed directory.
+struct scan_journal
+{
+    ScanJournalKey id;
+    fs::path root;
+    std::vector<pending_directory> pending;
+    fs::path last_directory;
+
+    auto completed() const -> bool { return pending.empty(); }
+};
 
+auto serialize_scan_journal(flatbuffers::FlatBufferBuilder& fbb, scan_journal const& journal)
+    -> buffer_view;
+
+// Reads may be done from several threads, LevelDB synchronizes them and every read gets its own iterator.
+// Libraries are written only by the scanner, before the server is started. The server uses the *_async
+// reads, which run on a pool of their own, so a read from the disk doesn't block the event loop.
 class store_service
 {
 public:
@@ -36,8 +84,12 @@ public:
     auto get_next_id() const -> int64_t;
 
     auto put_items(ObjectKey parent,
-                   std::vector<flatbuffers::DetachedBuffer>&& items,
-                   std::vector<std::tuple<ResourceKey, flatbuffers::DetachedBuffer>>&& resources) -> void;
+                   std::span<buffer_view const> items,
+                   std::span<std::tuple<ResourceKey, buffer_view> const> resources,
+                   scan_journal const* journal = nullptr) -> void;
+
+    auto get_scan_journal(ScanJournalKey id) -> std::optional<scan_journal>;
+    auto put_scan_journal(scan_journal const& journal) -> void;
 
     class list_result_view : public ranges::view_facade<list_result_view>
     {
@@ -108,6 +160,23 @@ public:
 
     auto get_resource(ResourceKey id) -> resource_result;
 
+    // A part of a listing, copied out of the DB, so serializing it doesn't touch the DB.
+    struct object_page
+    {
+        // Serialized MediaObjects.
+        std::vector<std::string> objects;
+        std::size_t total_matches{0};
+    };
+
+    // Children of the container from the start index, all of them when the count is 0.
+    auto list_async(ObjectKey id, std::uint32_t start_index, std::uint32_t count)
+        -> net::awaitable<object_page>;
+    // The object itself, the page is empty when it doesn't exist.
+    auto get_async(ObjectKey id)
+        -> net::awaitable<object_page>;
+    auto get_resource_async(ResourceKey id)
+        -> net::awaitable<resource_result>;
+
     auto open_db(store_config const& config) -> bool;
 
 private:
@@ -121,6 +190,10 @@ private:
 
     auto create_iterator() const -> std::unique_ptr<::leveldb::Iterator>;
 
+    // Copies the objects with keys from the start index.
+    auto read_objects(std::vector<std::string> const& keys, std::uint32_t start_index, std::uint32_t count) const
+        -> object_page;
+
     auto deserialize_container(std::string const& key, ::leveldb::Iterator& iter, bool meta)
         -> std::tuple<std::vector<std::string>, std::unique_ptr<container_meta>>;
 
@@ -128,6 +201,8 @@ private:
     fb_comparator comparator_;
     std::unique_ptr<::leveldb::DB> db_;
     int64_t id_{0};
+    // Created with the DB, declared after it so the reads are joined before it's closed.
+    std::unique_ptr<net::thread_pool> read_pool_;
 };
 }
 
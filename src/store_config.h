@@ -3,12 +3,16 @@
 
 #include "fs.h"
 
+#include <cstddef>
+
 namespace eems
 {
 
 struct store_config
 {
     fs::path db_path{"/var/lib/eems/db"};
+    // Threads doing the reads of the server, which block while the DB files are read from the disk.
+    std::size_t read_threads{2};
 };
 
 }
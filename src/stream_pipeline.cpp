@@ -0,0 +1,104 @@
+#include "stream_pipeline.h"
+
+#include <algorithm>
+#include <boost/asio/experimental/as_tuple.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/asio/experimental/channel.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+#include <chrono>
+#include <vector>
+
+namespace eems
+{
+
+namespace
+{
+// Chunks are sized so that writing one takes about this long.
+constexpr auto target_chunk_duration = std::chrono::microseconds(100'000);
+
+inline auto next_chunk_size(std::size_t bytes, std::chrono::steady_clock::duration elapsed, pipeline_limits const& limits)
+    -> std::size_t
+{
+    auto const micros = std::max<std::uintmax_t>(1, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    auto const target = static_cast<std::uintmax_t>(bytes) * target_chunk_duration.count() / micros;
+    // Multiples of the minimal chunk keep the reads aligned.
+    return static_cast<std::size_t>(
+        std::clamp<std::uintmax_t>(target / limits.min_chunk * limits.min_chunk, limits.min_chunk, limits.max_chunk));
+}
+}
+
+auto send_pipelined(tcp_stream& stream, chunk_reader read, std::uint64_t offset, std::uintmax_t size,
+                    pipeline_limits const& limits, write_pacer pace)
+    -> net::awaitable<beast::error_code>
+{
+    using namespace net::experimental::awaitable_operators;
+
+    auto executor = co_await net::this_coro::executor;
+    // Buffers grow with the chunk size, so slow clients don't cost much memory.
+    std::vector<std::vector<std::byte>> slots(limits.depth);
+    auto chunk_size = limits.min_chunk;
+
+    // Slots which were read (and how much) and slots which were written and can be reused.
+    net::experimental::channel<void(beast::error_code, std::size_t, std::size_t)> filled{executor, limits.depth};
+    net::experimental::channel<void(beast::error_code, std::size_t)> written{executor, limits.depth};
+    beast::error_code write_error;
+
+    auto read_chunks = [&, size]() mutable -> net::awaitable<void>
+    {
+        for (std::size_t chunk = 0; size; ++chunk)
+        {
+            auto const slot = chunk % limits.depth;
+            // The channel is closed when a write fails.
+            if (chunk >= limits.depth)
+            {
+                auto const [ec, written_slot] = co_await written.async_receive(net::experimental::as_tuple(net::use_awaitable));
+                if (ec)
+                    co_return;
+            }
+            auto const bytes = static_cast<std::size_t>(std::min<std::uintmax_t>(size, chunk_size));
+            auto& storage = slots[slot];
+            if (storage.size() < bytes)
+            {
+                storage.resize(bytes);
+            }
+            co_await read(offset, net::buffer(storage.data(), bytes));
+            offset += bytes;
+            size -= bytes;
+            if (auto const [ec] = co_await filled.async_send(beast::error_code{}, slot, bytes, net::experimental::as_tuple(net::use_awaitable)); ec)
+                co_return;
+        }
+    };
+
+    auto write_chunks = [&, size]() mutable -> net::awaitable<void>
+    {
+        while (size)
+        {
+            auto const [slot, bytes] = co_await filled.async_receive(net::use_awaitable);
+            auto const started = std::chrono::steady_clock::now();
+            stream.expires_after(limits.write_timeout);
+            if (auto const rc = co_await net::async_write(stream, net::buffer(slots[slot].data(), bytes)); !rc)
+            {
+                write_error = rc.error();
+                filled.close();
+                written.close();
+                co_return;
+            }
+            chunk_size = next_chunk_size(bytes, std::chrono::steady_clock::now() - started, limits);
+            size -= bytes;
+            co_await written.async_send(beast::error_code{}, slot, net::use_awaitable);
+            // The slot is already free, so the next chunk is read while waiting.
+            if (pace)
+            {
+                co_await pace(bytes);
+            }
+        }
+    };
+
+    // A failed read cancels the writes, a failed write stops the reads.
+    co_await (read_chunks() && write_chunks());
+    co_return write_error;
+}
+
+}
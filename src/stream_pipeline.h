@@ -0,0 +1,40 @@
+#ifndef EEMS_STREAM_PIPELINE_H
+#define EEMS_STREAM_PIPELINE_H
+
+#include "http_messages.h"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/buffer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace eems
+{
+
+// Fills the whole buffer with the data at the offset, throws on failure.
+using chunk_reader = std::function<net::awaitable<void>(std::uint64_t offset, net::mutable_buffer buffer)>;
+
+// Called after each write with its size, may delay the next one.
+using write_pacer = std::function<net::awaitable<void>(std::size_t bytes)>;
+
+struct pipeline_limits
+{
+    // Number of buffers, all but the one being written can be read ahead.
+    std::size_t depth{2};
+    std::size_t min_chunk{64 * 1024};
+    std::size_t max_chunk{2 * 1024 * 1024};
+    // Deadline of each write, so the stream lasts as long as the client keeps reading.
+    std::chrono::steady_clock::duration write_timeout{std::chrono::seconds(30)};
+};
+
+// Sends size bytes from the offset, the next chunk is always read while the previous one is being written.
+// Chunk size follows how fast the client drains the socket. Returns the error of a failed write,
+// e.g. when the client is gone, while a failed read throws.
+auto send_pipelined(tcp_stream& stream, chunk_reader read, std::uint64_t offset, std::uintmax_t size,
+                    pipeline_limits const& limits = {}, write_pacer pace = {})
+    -> net::awaitable<beast::error_code>;
+
+}
+
+#endif
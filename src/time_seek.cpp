@@ -0,0 +1,136 @@
+#include "time_seek.h"
+
+#include "spirit.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fmt/format.h>
+
+namespace eems
+{
+
+namespace
+{
+auto parse_npt_time(std::string_view text) -> std::optional<std::chrono::milliseconds>
+{
+    constexpr x3::real_parser<double, x3::ureal_policies<double>> seconds_parser;
+    double seconds = 0;
+    unsigned hours = 0, minutes = 0;
+    auto const colon = text.find(':');
+    if (colon == text.npos)
+    {
+        if (!parse(text, seconds_parser, seconds))
+            return std::nullopt;
+    }
+    else
+    {
+        auto const second_colon = text.find(':', colon + 1);
+        if (second_colon == text.npos ||
+            !parse(text.substr(0, colon), x3::uint_, hours) ||
+            !parse(text.substr(colon + 1, second_colon - colon - 1), x3::uint_parser<unsigned, 10, 2, 2>{}, minutes) ||
+            !parse(text.substr(second_colon + 1), seconds_parser, seconds) ||
+            minutes > 59 || seconds >= 60)
+        {
+            return std::nullopt;
+        }
+    }
+    return std::chrono::milliseconds{std::llround(((hours * 60.0 + minutes) * 60.0 + seconds) * 1000)};
+}
+
+auto format_npt_time(std::chrono::milliseconds time) -> std::string
+{
+    auto const count = time.count();
+    return fmt::format("{}:{:02}:{:02}.{:03}", count / 3'600'000, count / 60'000 % 60, count / 1000 % 60, count % 1000);
+}
+
+inline auto trim(std::string_view text) -> std::string_view
+{
+    auto const first = text.find_first_not_of(" \t");
+    if (first == text.npos)
+        return {};
+    return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+}
+}
+
+auto parse_npt_range(std::string_view header)
+    -> std::optional<npt_range>
+{
+    header = trim(header);
+    if (!header.starts_with("npt="))
+        return std::nullopt;
+    header.remove_prefix(4);
+
+    auto const dash = header.find('-');
+    if (dash == header.npos)
+        return std::nullopt;
+
+    auto const start = parse_npt_time(trim(header.substr(0, dash)));
+    if (!start)
+        return std::nullopt;
+    npt_range result{*start, std::nullopt};
+    if (auto const end = trim(header.substr(dash + 1)); !end.empty())
+    {
+        result.end = parse_npt_time(end);
+        if (!result.end || *result.end < result.start)
+            return std::nullopt;
+    }
+    return result;
+}
+
+auto find_time_seek_range(npt_range const& requested, Resource const& resource, std::uintmax_t file_size)
+    -> std::optional<time_seek_range>
+{
+    auto const& index = *resource.seek_index();
+    auto const duration = std::chrono::milliseconds{resource.duration()};
+    if (index.size() == 0 || (duration.count() && requested.start >= duration))
+        return std::nullopt;
+
+    // The first keyframe after the time, index.size() if there's none.
+    auto const after = [&index](std::chrono::milliseconds time) -> flatbuffers::uoffset_t
+    {
+        return std::upper_bound(index.begin(), index.end(), time.count(), [](std::int64_t time, SeekPoint const* point)
+                                { return time < point->time(); }) -
+               index.begin();
+    };
+
+    time_seek_range result{.duration = duration};
+    // Playback can only start at a keyframe, so it starts at the one before the time.
+    auto const after_start = after(requested.start);
+    if (after_start == 0)
+    {
+        result.bytes.offset = 0;
+        result.start = std::chrono::milliseconds{0};
+    }
+    else
+    {
+        result.bytes.offset = index.Get(after_start - 1)->offset();
+        result.start = std::chrono::milliseconds{index.Get(after_start - 1)->time()};
+    }
+
+    std::uintmax_t end_offset = file_size;
+    result.end = duration;
+    if (requested.end)
+    {
+        if (auto const after_end = after(*requested.end); after_end < index.size())
+        {
+            end_offset = index.Get(after_end)->offset();
+            result.end = std::chrono::milliseconds{index.Get(after_end)->time()};
+        }
+    }
+    if (result.bytes.offset >= file_size || end_offset <= result.bytes.offset)
+        return std::nullopt;
+    result.bytes.size = std::min<std::uintmax_t>(end_offset, file_size) - result.bytes.offset;
+    return result;
+}
+
+auto format_time_seek_range(time_seek_range const& range, std::uintmax_t file_size)
+    -> std::string
+{
+    return fmt::format("npt={}-{}/{} bytes={}-{}/{}",
+                       format_npt_time(range.start),
+                       range.end.count() ? format_npt_time(range.end) : std::string{},
+                       range.duration.count() ? format_npt_time(range.duration) : std::string{"*"},
+                       range.bytes.offset, range.bytes.offset + range.bytes.size - 1, file_size);
+}
+
+}
@@ -0,0 +1,47 @@
+#ifndef EEMS_TIME_SEEK_H
+#define EEMS_TIME_SEEK_H
+
+#include "byte_ranges.h"
+#include "store/schema_generated.h"
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace eems
+{
+
+// Requested play time range of TimeSeekRange.dlna.org.
+struct npt_range
+{
+    std::chrono::milliseconds start;
+    std::optional<std::chrono::milliseconds> end;
+};
+
+// Parses "npt=<start>-[<end>]", times are either seconds ("90.5") or "h:mm:ss[.sss]".
+auto parse_npt_range(std::string_view header)
+    -> std::optional<npt_range>;
+
+struct time_seek_range
+{
+    byte_range bytes;
+    // Times of the keyframes the bytes start and end at.
+    std::chrono::milliseconds start;
+    std::chrono::milliseconds end;
+    // Of the whole video, 0 when unknown.
+    std::chrono::milliseconds duration;
+};
+
+// Bytes from the keyframe at or before the start up to the first keyframe after the end, using the seek index
+// of the resource, which must have one. Returns nullopt when the range is outside of the video.
+auto find_time_seek_range(npt_range const& requested, Resource const& resource, std::uintmax_t file_size)
+    -> std::optional<time_seek_range>;
+
+// Value of the TimeSeekRange.dlna.org response header.
+auto format_time_seek_range(time_seek_range const& range, std::uintmax_t file_size)
+    -> std::string;
+
+}
+
+#endif
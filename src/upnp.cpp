@@ -43,12 +43,48 @@ inline auto make_string_buffer(char const* str)
     return {str, std::strlen(str)};
 }
 
-auto make_upnp_error_response(upnp_error const& error, http_request const& req)
+namespace
+{
+class upnp_category_impl : public boost::system::error_category
+{
+public:
+    auto name() const noexcept -> char const* override
+    {
+        return "eems.upnp";
+    }
+
+    auto message(int ev) const -> std::string override
+    {
+        switch (static_cast<upnp_errc>(ev))
+        {
+        case upnp_errc::invalid_action:
+            return "Invalid Action";
+        case upnp_errc::invalid_args:
+            return "Invalid Args";
+        case upnp_errc::argument_value_invalid:
+            return "Argument Value Invalid";
+        case upnp_errc::argument_value_out_of_range:
+            return "Argument Value Out of Range";
+        case upnp_errc::no_such_object:
+            return "No such object";
+        }
+        return "Action Failed";
+    }
+};
+}
+
+auto upnp_category() noexcept -> boost::system::error_category const&
+{
+    static upnp_category_impl const category;
+    return category;
+}
+
+auto make_upnp_error_response(boost::system::error_code const& error, http_request const& req)
     -> error_response_ptr
 {
     auto res = std::make_unique<error_response_ptr::element_type>(
         std::piecewise_construct,
-        std::forward_as_tuple(error_response(static_cast<int>(error.code_), error.what())),
+        std::forward_as_tuple(error_response(error.value(), error.message().c_str())),
         std::make_tuple(http::status::internal_server_error, req.version()));
 
     res->set(http::field::server, BOOST_BEAST_VERSION_STRING);
@@ -58,8 +94,8 @@ auto make_upnp_error_response(upnp_error const& error, http_request const& req)
     return res;
 }
 
-auto upnp_service::handle_cds_browse(tcp_stream& stream, http_request&& req, soap_action_info const& soap_req)
-    -> net::awaitable<void>
+auto upnp_service::handle_cds_browse(tcp_stream& stream, http_request& req, soap_action_info const& soap_req)
+    -> net::awaitable<io_result<>>
 {
     // TODO: There are filter and search criteria and start index / count
     // TODO: Also returns dumb NumberReturned value and TotalMatches and UpdateID
@@ -67,65 +103,72 @@ auto upnp_service::handle_cds_browse(tcp_stream& stream, http_request&& req, soa
     int64_t object_id;
     if (auto const id = soap_req.params.child_value("ObjectID"); !parse(std::string_view{id}, x3::int64, object_id))
     {
-        throw upnp_error{upnp_error::code::no_such_object, "Invalid ID"};
+        co_return upnp_errc::no_such_object;
     }
     uint32_t start_index = 0;
     if (auto const val = soap_req.params.child_value("StartingIndex"); !parse(std::string_view{val}, x3::uint32, start_index))
     {
-        throw upnp_error{upnp_error::code::invalid_args, "Invalid StartingIndex"};
+        co_return upnp_errc::invalid_args;
     }
     uint32_t requested_count = 0;
     if (auto const val = soap_req.params.child_value("RequestedCount"); !parse(std::string_view{val}, x3::uint32, requested_count))
     {
-        throw upnp_error{upnp_error::code::invalid_args, "Invalid RequestedCount"};
+        co_return upnp_errc::invalid_args;
+    }
+
+    // Objects are read on the store's pool, so a read from the disk doesn't hold up other clients.
+    store_service::object_page page;
+    if (auto const flag = std::string_view{soap_req.params.child_value("BrowseFlag")}; flag == "BrowseDirectChildren")
+    {
+        page = co_await store_service_.list_async(ObjectKey{object_id}, start_index, requested_count);
+    }
+    else if (flag == "BrowseMetadata")
+    {
+        page = co_await store_service_.get_async(ObjectKey{object_id});
+        if (page.objects.empty())
+        {
+            co_return upnp_errc::no_such_object;
+        }
+    }
+    else
+    {
+        co_return upnp_errc::argument_value_out_of_range;
     }
 
-    auto contents = [flag = std::string_view{soap_req.params.child_value("BrowseFlag")},
-                     key = ObjectKey{object_id},
-                     &store_service = store_service_]() -> store_service::list_result_view {
-        if (flag == "BrowseDirectChildren")
-            return store_service.list(key);
-        else if (flag == "BrowseMetadata")
-            return store_service.get(key);
-        else
-            throw upnp_error{upnp_error::code::argument_value_out_of_range, "Invalid BrowseFlag"};
-    }();
-
-    co_await http::async_write(
-        stream, create_buffer_response(
-                    req, browse_response(std::move(contents), start_index, requested_count, server_config_.base_url).cdata(), "text/xml"));
+    co_return discard_value(co_await http::async_write(
+        stream, create_buffer_response(req, browse_response(page, server_config_.base_url).cdata(), "text/xml")));
 }
 
-auto upnp_service::handle_upnp_request(tcp_stream& stream, http_request&& req, fs::path sub_path)
-    -> net::awaitable<void>
+auto upnp_service::handle_upnp_request(tcp_stream& stream, http_request& req, std::string_view sub_path)
+    -> net::awaitable<io_result<>>
 {
-    if (sub_path.native() == "device")
+    if (sub_path == "device")
+    {
+        co_return discard_value(co_await http::async_write(stream, create_buffer_response(req, root_device_description(server_config_).cdata(), "text/xml")));
+    }
+    else if (sub_path == "cds.xml")
     {
-        co_await http::async_write(stream, create_buffer_response(req, root_device_description(server_config_).cdata(), "text/xml"));
-        co_return;
+        co_return discard_value(co_await http::async_write(stream, create_buffer_response(req, make_string_buffer(cds_xml), "text/xml")));
     }
-    else if (sub_path.native() == "cds.xml")
+    else if (sub_path == "cm.xml")
     {
-        co_await http::async_write(stream, create_buffer_response(req, make_string_buffer(cds_xml), "text/xml"));
-        co_return;
+        co_return discard_value(co_await http::async_write(stream, create_buffer_response(req, make_string_buffer(cm_xml), "text/xml")));
     }
-    else if (sub_path.native() == "cm.xml")
+    auto soap_info = soap_action_info{};
+    if (auto const parsed = parse_soap_request(req, soap_info); !parsed)
     {
-        co_await http::async_write(stream, create_buffer_response(req, make_string_buffer(cm_xml), "text/xml"));
-        co_return;
+        co_return parsed;
     }
-    auto soap_info = parse_soap_request(req);
 
-    if (sub_path.native() == "cds")
+    if (sub_path == "cds")
     {
         if (soap_info.action != "Browse")
         {
             // TODO: Here we can send SOAP error instead. Fault or so...
-            throw http_error{http::status::bad_request, "Invalid action"};
+            co_return make_http_error(http::status::bad_request);
         }
-        co_await handle_cds_browse(stream, std::move(req), soap_info);
-        co_return;
+        co_return co_await handle_cds_browse(stream, req, soap_info);
     }
-    throw http_error{http::status::not_found, "Not found"};
+    co_return make_http_error(http::status::not_found);
 }
 }
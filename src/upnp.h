@@ -1,41 +1,44 @@
 #ifndef EEMS_UPNP_H
 #define EEMS_UPNP_H
 
-#include "fs.h"
+#include "frame_pool.h"
 #include "http_messages.h"
 #include "server_config.h"
 #include "store/store_service.h"
 
+#include <string_view>
+
 namespace eems
 {
 struct soap_action_info;
 
-class upnp_error : public std::runtime_error
+enum class upnp_errc : int
 {
-public:
-    enum class code : int
-    {
-        invalid_action = 401,
-        invalid_args = 402,
+    invalid_action = 401,
+    invalid_args = 402,
 
-        argument_value_invalid = 600,
-        argument_value_out_of_range = 601,
+    argument_value_invalid = 600,
+    argument_value_out_of_range = 601,
 
-        no_such_object = 701,
-    };
+    no_such_object = 701,
+};
 
-    upnp_error(code c, char const* description)
-        : runtime_error{description},
-          code_{c}
-    {
-    }
+// Errors answered with a SOAP fault, the value of the code is the UPnP error code.
+auto upnp_category() noexcept -> boost::system::error_category const&;
 
-    code code_;
-};
+inline auto make_error_code(upnp_errc e) -> boost::system::error_code
+{
+    return {static_cast<int>(e), upnp_category()};
+}
 
-auto make_upnp_error_response(upnp_error const& error, http_request const& req)
+auto make_upnp_error_response(boost::system::error_code const& error, http_request const& req)
     -> error_response_ptr;
 
+// Browse requests are frequent and short, their frames are recycled.
+class upnp_service;
+template <>
+inline constexpr bool pooled_frames<upnp_service> = true;
+
 class upnp_service
 {
 public:
@@ -46,12 +49,12 @@ public:
     {
     }
 
-    auto handle_upnp_request(tcp_stream& stream, http_request&& req, fs::path sub_path)
-        -> net::awaitable<void>;
+    auto handle_upnp_request(tcp_stream& stream, http_request& req, std::string_view sub_path)
+        -> net::awaitable<io_result<>>;
 
 private:
-    auto handle_cds_browse(tcp_stream& stream, http_request&& req, soap_action_info const& soap_req)
-        -> net::awaitable<void>;
+    auto handle_cds_browse(tcp_stream& stream, http_request& req, soap_action_info const& soap_req)
+        -> net::awaitable<io_result<>>;
 
 private:
     store_service& store_service_;
@@ -59,4 +62,9 @@ private:
 };
 }
 
+template <>
+struct boost::system::is_error_code_enum<eems::upnp_errc> : std::true_type
+{
+};
+
 #endif
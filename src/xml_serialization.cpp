@@ -7,14 +7,15 @@
 
 #include <boost/uuid/uuid_io.hpp>
 #include <chrono>
+#include <concepts>
 #include <date/date.h>
-#include <fmt/core.h>
+#include <fmt/format.h>
 #include <pugixml.hpp>
 #include <range/v3/algorithm/count_if.hpp>
 #include <range/v3/algorithm/for_each.hpp>
-#include <range/v3/view/drop.hpp>
-#include <range/v3/view/take.hpp>
 #include <spdlog/spdlog.h>
+#include <string_view>
+#include <type_traits>
 
 namespace eems
 {
@@ -38,14 +39,6 @@ private:
     beast::flat_buffer& buffer;
 };
 
-inline auto append_null(beast::flat_buffer& buffer)
-{
-    auto buf = buffer.prepare(1);
-    constexpr auto null_char = '\0';
-    std::memcpy(buf.data(), &null_char, 1);
-    buffer.commit(1);
-}
-
 auto generate_preamble(char const* root_element, char const* root_ns)
     -> std::tuple<pugi::xml_document, pugi::xml_node>
 {
@@ -111,46 +104,165 @@ auto root_device_description(server_config const& server_config) -> beast::flat_
     return result;
 }
 
-auto serialize_media_object(pugi::xml_node& didl_root, std::string_view content_base, MediaObject const& object) -> bool
+namespace
+{
+// Writes XML straight into the buffer. A document embedded as the text of an element of another one (DIDL-Lite
+// in the Result of Browse) is escaped once more while it's written, so it takes a single pass.
+class xml_writer
+{
+public:
+    explicit xml_writer(beast::flat_buffer& buffer)
+        : buffer_{buffer}
+    {
+    }
+    xml_writer& operator=(xml_writer&&) = delete;
+
+    auto markup(std::string_view markup) -> xml_writer&
+    {
+        write_escaped(markup, embedding_);
+        return *this;
+    }
+
+    auto text(std::string_view text) -> xml_writer&
+    {
+        write_escaped(text, embedding_ + 1);
+        return *this;
+    }
+
+    auto number(std::integral auto value) -> xml_writer&
+    {
+        auto const formatted = fmt::format_int{value};
+        write({formatted.data(), formatted.size()});
+        return *this;
+    }
+
+    template <typename Value>
+    auto attribute(std::string_view name, Value const& value) -> xml_writer&
+    {
+        markup(" ").markup(name).markup("=\"");
+        if constexpr (std::is_integral_v<Value>)
+            number(value);
+        else
+            text(value);
+        return markup("\"");
+    }
+
+    template <typename Value>
+    auto element(std::string_view name, Value const& value) -> xml_writer&
+    {
+        markup("<").markup(name).markup(">");
+        if constexpr (std::is_integral_v<Value>)
+            number(value);
+        else
+            text(value);
+        return markup("</").markup(name).markup(">");
+    }
+
+    // What's written in between is the text of the current element.
+    auto begin_embedded() -> void
+    {
+        ++embedding_;
+    }
+
+    auto end_embedded() -> void
+    {
+        --embedding_;
+    }
+
+private:
+    auto write(std::string_view data) -> void
+    {
+        buffer_.commit(net::buffer_copy(buffer_.prepare(data.size()), net::const_buffer{data.data(), data.size()}));
+    }
+
+    auto write_escaped(std::string_view data, int times) -> void
+    {
+        if (!times)
+        {
+            write(data);
+            return;
+        }
+        for (;;)
+        {
+            auto const special = data.find_first_of("&<>\"");
+            write(data.substr(0, special));
+            if (special == data.npos)
+                return;
+            // An entity in embedded text is escaped again.
+            write_escaped(entity(data[special]), times - 1);
+            data.remove_prefix(special + 1);
+        }
+    }
+
+    static constexpr auto entity(char c) -> std::string_view
+    {
+        switch (c)
+        {
+        case '&':
+            return "&amp;";
+        case '<':
+            return "&lt;";
+        case '>':
+            return "&gt;";
+        default:
+            return "&quot;";
+        }
+    }
+
+    beast::flat_buffer& buffer_;
+    int embedding_{0};
+};
+
+// Leaves room for the usual object, so the buffer rarely grows while a page is written.
+constexpr std::size_t object_size_hint = 1024;
+
+auto serialize_media_object(xml_writer& out, std::string_view content_base, MediaObject const& object) -> bool
 {
-    auto resource_url = [content_base](int64_t id)
+    auto resource_url = [&out, content_base](int64_t id)
     {
-        return fmt::format("{}/content/{}", content_base, id);
+        out.text(content_base).text("/content/").number(id);
     };
-    auto serialize_common_fields = [&object, resource_url](pugi::xml_node& node)
+    auto serialize_common_fields = [&out, &object, resource_url]()
     {
-        node.append_attribute("id").set_value(object.id()->id());
-        node.append_attribute("parentID").set_value(object.parent_id()->id());
-        node.append_attribute("restricted").set_value("1");
+        out.attribute("id", object.id()->id())
+            .attribute("parentID", object.parent_id()->id())
+            .attribute("restricted", "1")
+            .markup(">");
 
-        node.append_child("dc:title").text().set(as_cstring<char>(*object.dc_title()));
-        node.append_child("upnp:class").text().set(as_cstring<char>(*object.upnp_class()));
+        out.element("dc:title", as_string_view<char>(*object.dc_title()));
+        out.element("upnp:class", as_string_view<char>(*object.upnp_class()));
         if (auto days = object.dc_date(); days)
         {
             date::year_month_day const date{date::sys_days{std::chrono::days{days}}};
-            node.append_child("dc:date").text().set(
-                fmt::format("{:04}-{:02}-{:02}",
-                            static_cast<int>(date.year()),
-                            static_cast<unsigned>(date.month()),
-                            static_cast<unsigned>(date.day()))
-                    .c_str());
+            out.element("dc:date", fmt::format("{:04}-{:02}-{:02}",
+                                               static_cast<int>(date.year()),
+                                               static_cast<unsigned>(date.month()),
+                                               static_cast<unsigned>(date.day())));
         }
-        ranges::for_each(fb_vector_view{object.artwork()}, [&node, resource_url](Artwork const& aw)
+        ranges::for_each(fb_vector_view{object.artwork()}, [&out, resource_url](Artwork const& aw)
                          {
             auto const id = aw.ref_nested_root()->key_as_ResourceKey()->id();
-            // TODO: Some set dlna:protocolInfo extension to JPEG_TN, but it seems to be ignored.
-            auto const url = resource_url(id);
-            node.append_child("upnp:albumArtURI").text().set(url.c_str());
-            auto aw_node = node.append_child("xbmc:artwork");
-            aw_node.text().set(url.c_str());
+            // Downscaled variants come first, so renderers showing a grid don't pull the original.
+            ranges::for_each(fb_vector_view{aw.variants()}, [&out, resource_url](ArtworkVariant const& variant)
+                             {
+                out.markup("<upnp:albumArtURI").attribute("dlna:profileID", std::string_view{EnumNameArtworkProfile(variant.profile())}).markup(">");
+                resource_url(variant.ref_nested_root()->key_as_ResourceKey()->id());
+                out.markup("</upnp:albumArtURI>"); });
+            out.markup("<upnp:albumArtURI>");
+            resource_url(id);
+            out.markup("</upnp:albumArtURI>");
+            out.markup("<xbmc:artwork");
             switch (aw.type())
             {
             case ArtworkType::Poster:
-                aw_node.append_attribute("type").set_value("poster");
+                out.attribute("type", "poster");
                 break;
             case ArtworkType::Thumbnail:
-                aw_node.append_attribute("type").set_value("thumb");
-            }; });
+                out.attribute("type", "thumb");
+            };
+            out.markup(">");
+            resource_url(id);
+            out.markup("</xbmc:artwork>"); });
     };
 
     switch (object.data_type())
@@ -158,29 +270,31 @@ auto serialize_media_object(pugi::xml_node& didl_root, std::string_view content_
     case ObjectUnion::MediaItem:
     {
         auto& item = *static_cast<MediaItem const*>(object.data());
-        auto node = didl_root.append_child("item");
-        serialize_common_fields(node);
+        out.markup("<item");
+        serialize_common_fields();
         ranges::for_each(fb_vector_view{item.resources()},
-                         [&node, resource_url](ResourceRef const& r)
+                         [&out, resource_url](ResourceRef const& r)
                          {
                              if (auto res_key = r.ref_nested_root()->key_as_ResourceKey(); res_key)
                              {
-                                 auto res = node.append_child("res");
-                                 res.append_attribute("protocolInfo").set_value(as_cstring<char>(*r.protocol_info()));
-                                 res.text().set(resource_url(res_key->id()).c_str());
+                                 out.markup("<res").attribute("protocolInfo", as_string_view<char>(*r.protocol_info())).markup(">");
+                                 resource_url(res_key->id());
+                                 out.markup("</res>");
                              }
                              else
                              {
                                  throw std::runtime_error{"Resource ref has no valid resource key"};
                              }
                          });
+        out.markup("</item>");
     }
     break;
     case ObjectUnion::MediaContainer:
     {
         // auto& container = *static_cast<MediaContainer const*>(object.data());
-        auto node = didl_root.append_child("container");
-        serialize_common_fields(node);
+        out.markup("<container");
+        serialize_common_fields();
+        out.markup("</container>");
     }
     break;
 
@@ -190,6 +304,7 @@ auto serialize_media_object(pugi::xml_node& didl_root, std::string_view content_
     }
     return true;
 }
+}
 
 inline auto add_soap_envelope(pugi::xml_document& xml_doc) -> pugi::xml_node
 {
@@ -199,45 +314,39 @@ inline auto add_soap_envelope(pugi::xml_document& xml_doc) -> pugi::xml_node
     return soap_root.append_child("s:Body");
 }
 
-auto browse_response(store_service::list_result_view const& list,
-                     uint32_t start_index, uint32_t requested_count,
+auto browse_response(store_service::object_page const& page,
                      std::string_view base_url)
     -> beast::flat_buffer
 {
-    auto [xml_doc, didl_root] = generate_preamble("DIDL-Lite", "urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/");
-    didl_root.append_attribute("xmlns:upnp").set_value("urn:schemas-upnp-org:metadata-1-0/upnp/");
-    didl_root.append_attribute("xmlns:dc").set_value("http://purl.org/dc/elements/1.1/");
-    didl_root.append_attribute("xmlns:xbmc").set_value("urn:schemas-xbmc-org:metadata-1-0/");
-
-    static_assert(ranges::random_access_range<store_service::list_result_view>, "Must be a random access");
-    auto const size = ranges::size(list);
-    if (!requested_count)
-        requested_count = size;
-    auto const count = ranges::count_if(
-        list | views::drop(start_index) | views::take(requested_count),
-        std::bind_front(&serialize_media_object, std::ref(didl_root), base_url));
-
     beast::flat_buffer result;
-    buffer_writer writer{result};
-
-    xml_doc.print(writer);
-    // Unfortunately PugiXML doesn't provide string_view-like interfaces, only C-strings...
-    append_null(result);
-
-    xml_doc.reset();
-    auto soap_body = add_soap_envelope(xml_doc);
-
-    // TODO: This is service type / action + Response
-    auto response = soap_body.append_child("u:BrowseResponse");
-    response.append_attribute("xmlns:u").set_value("urn:schemas-upnp-org:service:ContentDirectory:1");
-    response.append_child("NumberReturned").text().set(count);
-    response.append_child("TotalMatches").text().set(size);
-    response.append_child("UpdateID").text().set("0");
-    response.append_child("Result").text().set(static_cast<char const*>(result.data().data()));
-
-    // Just reuse same writer / buffer...
-    result.consume(result.size());
-    xml_doc.print(writer);
+    result.reserve((page.objects.size() + 1) * object_size_hint);
+    xml_writer out{result};
+
+    out.markup(R"(<?xml version="1.0" encoding="UTF-8"?>)")
+        .markup(R"(<s:Envelope xmlns:s="http://schemas.xmlsoap.org/soap/envelope/" s:encodingStyle="http://schemas.xmlsoap.org/soap/encoding/">)")
+        .markup("<s:Body>")
+        // TODO: This is service type / action + Response
+        .markup(R"(<u:BrowseResponse xmlns:u="urn:schemas-upnp-org:service:ContentDirectory:1">)")
+        .markup("<Result>");
+
+    // Result comes first (as in the service description), so the count is known when it's written.
+    out.begin_embedded();
+    out.markup(R"(<?xml version="1.0" encoding="UTF-8"?>)")
+        .markup(R"(<DIDL-Lite xmlns="urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/")")
+        .markup(R"( xmlns:upnp="urn:schemas-upnp-org:metadata-1-0/upnp/" xmlns:dc="http://purl.org/dc/elements/1.1/")")
+        .markup(R"( xmlns:xbmc="urn:schemas-xbmc-org:metadata-1-0/" xmlns:dlna="urn:schemas-dlna-org:metadata-1-0/">)");
+    auto const count = ranges::count_if(
+        page.objects,
+        [&](std::string const& object)
+        { return serialize_media_object(out, base_url, *flatbuffers::GetRoot<MediaObject>(object.data())); });
+    out.markup("</DIDL-Lite>");
+    out.end_embedded();
+
+    out.markup("</Result>")
+        .element("NumberReturned", count)
+        .element("TotalMatches", page.total_matches)
+        .element("UpdateID", 0)
+        .markup("</u:BrowseResponse></s:Body></s:Envelope>");
 
     return result;
 }
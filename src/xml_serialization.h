@@ -13,8 +13,8 @@ namespace eems
 auto root_device_description(server_config const& server_config)
     -> beast::flat_buffer;
 
-auto browse_response(store_service::list_result_view const& list,
-                     uint32_t start_index, uint32_t requested_count,
+// The SOAP envelope with the page as DIDL-Lite, written into the buffer in a single pass.
+auto browse_response(store_service::object_page const& page,
                      std::string_view base_url)
     -> beast::flat_buffer;
 
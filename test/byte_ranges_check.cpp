@@ -0,0 +1,76 @@
+// Parses the Range headers of a corpus and compares the ranges with the expected ones.
+//
+// Usage: byte_ranges_check <corpus.tsv>
+// Each line of the corpus is a Range header, the size of the file and the expected ranges, separated by tabs.
+// Ranges are written as offset+size separated by commas, "whole" when the whole file is sent and "none" when no
+// range can be satisfied. Lines starting with # are skipped.
+
+#include "byte_ranges.h"
+
+#include <cstdlib>
+#include <fmt/format.h>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+namespace
+{
+auto format_ranges(std::optional<std::vector<eems::byte_range>> const& ranges) -> std::string
+{
+    if (!ranges)
+        return "none";
+    if (ranges->empty())
+        return "whole";
+    std::string result;
+    for (auto const& range : *ranges)
+        result += fmt::format("{}{}+{}", result.empty() ? "" : ",", range.offset, range.size);
+    return result;
+}
+}
+
+int main(int argc, char const* argv[])
+{
+    if (argc != 2)
+    {
+        fmt::print(stderr, "Usage: {} <corpus.tsv>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::ifstream corpus{argv[1]};
+    if (!corpus)
+    {
+        fmt::print(stderr, "Can't open {}\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    std::size_t headers = 0;
+    std::size_t failures = 0;
+    std::string line;
+    while (std::getline(corpus, line))
+    {
+        if (line.empty() || line.front() == '#')
+            continue;
+
+        ++headers;
+        auto const header_end = line.find('\t');
+        auto const size_end = line.find('\t', header_end + 1);
+        if (header_end == line.npos || size_end == line.npos)
+        {
+            ++failures;
+            fmt::print("Invalid line: {}\n", line);
+            continue;
+        }
+        auto const header = std::string_view{line}.substr(0, header_end);
+        auto const file_size = std::stoull(line.substr(header_end + 1, size_end - header_end - 1));
+        auto const expected = std::string_view{line}.substr(size_end + 1);
+
+        auto const parsed = format_ranges(eems::parse_byte_ranges(header, file_size));
+        if (parsed != expected)
+        {
+            ++failures;
+            fmt::print("\"{}\" of {} bytes is {}, expected {}\n", header, file_size, parsed, expected);
+        }
+    }
+
+    fmt::print("{} headers, {} mismatched\n", headers, failures);
+    return failures || !headers ? EXIT_FAILURE : EXIT_SUCCESS;
+}
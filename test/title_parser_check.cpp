@@ -0,0 +1,75 @@
+// Parses the release names of a corpus and compares the results with the expected ones.
+//
+// Usage: title_parser_check <corpus.tsv>
+// Each line of the corpus is a release name followed by its expected title, year, resolution, source, video codec
+// and audio codec, separated by tabs. Empty lines and lines starting with # are skipped.
+
+#include "scanner/title_parser.h"
+
+#include <array>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+namespace
+{
+constexpr std::array field_names{"title", "year", "resolution", "source", "video codec", "audio codec"};
+
+auto split(std::string_view line) -> std::array<std::string_view, 1 + field_names.size()>
+{
+    std::array<std::string_view, 1 + field_names.size()> fields{};
+    for (auto& field : fields)
+    {
+        auto const tab = line.find('\t');
+        field = line.substr(0, tab);
+        line = tab == line.npos ? std::string_view{} : line.substr(tab + 1);
+    }
+    return fields;
+}
+}
+
+int main(int argc, char const* argv[])
+{
+    if (argc != 2)
+    {
+        fmt::print(stderr, "Usage: {} <corpus.tsv>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::ifstream corpus{argv[1]};
+    if (!corpus)
+    {
+        fmt::print(stderr, "Can't open {}\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    std::size_t names = 0;
+    std::size_t failures = 0;
+    std::string line;
+    while (std::getline(corpus, line))
+    {
+        if (line.empty() || line.front() == '#')
+            continue;
+
+        ++names;
+        auto const fields = split(line);
+        auto const name = fields[0];
+        auto const release = eems::parse_release_name({reinterpret_cast<char8_t const*>(name.data()), name.size()});
+        auto const year = release.year ? std::to_string(release.year) : std::string{"0"};
+        std::array<std::string_view, field_names.size()> const parsed{
+            release.title, year, release.resolution, release.source, release.video_codec, release.audio_codec};
+
+        for (std::size_t i = 0; i < parsed.size(); ++i)
+        {
+            if (parsed[i] != fields[i + 1])
+            {
+                ++failures;
+                fmt::print("{}: {} is \"{}\", expected \"{}\"\n", name, field_names[i], parsed[i], fields[i + 1]);
+            }
+        }
+    }
+
+    fmt::print("{} release names, {} mismatched fields\n", names, failures);
+    return failures || !names ? EXIT_FAILURE : EXIT_SUCCESS;
+}